@@ -2,28 +2,6 @@
 
 #pragma once
 
-struct BBox;
-struct Object;
-
-struct IntersectionInfo {
-    float t, u, v; // Intersection distance along the ray
-    const Object* object; // Object that was hit
-};
-
-struct Object {
-    //! All "Objects" must be able to test for intersections with rays.
-    virtual bool getIntersection(const TinyRender::Ray& ray, IntersectionInfo* intersection) const = 0;
-
-    //! Return an object normal based on an intersection
-    virtual v3f getNormal(const IntersectionInfo& I) const = 0;
-
-    //! Return a bounding box for this object
-    virtual BBox getBBox() const = 0;
-
-    //! Return the centroid for this object. (Used in BVH Sorting)
-    virtual v3f getCentroid() const = 0;
-};
-
 struct BBox {
     v3f min, max, extent;
     BBox() { }
@@ -65,6 +43,8 @@ struct BBox {
         if (tzmax < tmax)
             tmax = tzmax;
 
+        *tnear = tmin;
+        *tfar = tmax;
         return true;
     }
 
@@ -90,6 +70,14 @@ struct BBox {
     }
 };
 
+//! Primitive handed to the builder: its bounds, its centroid and its index in the caller's list.
+//! The builder reorders these records so that every leaf covers a range of them.
+struct BVHPrimitive {
+    BBox bbox;
+    v3f centroid;
+    uint32_t index;
+};
+
 //! Node for storing state information during traversal.
 struct BVHTraversal {
     uint32_t i; // Node
@@ -111,18 +99,36 @@ struct BVHBuildEntry {
     uint32_t start, end;
 };
 
+//! Settings of the BVH builder.
+//! The SAH builder bins primitive centroids along each axis and picks the split plane minimizing
+//! traversalCost + (area(left) * count(left) + area(right) * count(right)) / area(node) * leafCost,
+//! and only makes leaves when that beats intersecting all the primitives of the node.
+//! The midpoint builder splits at the centroid midpoint of the longest axis: faster to build, slower to trace.
+struct BVHBuildSettings {
+    bool sah = true;
+    uint32_t leafSize = 4;          // Largest leaf
+    uint32_t nbBins = 16;           // Centroid bins per axis (SAH only)
+    float traversalCost = 1.f;      // Cost of visiting an inner node (SAH only)
+    float leafCost = 1.f;           // Cost of intersecting one primitive of a leaf (SAH only)
+};
+
 //! \author Brandon Pelfrey
 //! A Bounding Volume Hierarchy system for fast Ray-Object intersection tests
 class BVH {
     uint32_t nNodes, nLeafs, leafSize;
-    std::vector<Object*>* build_prims;
+    std::vector<BVHPrimitive>* build_prims;
+    BVHBuildSettings settings;
+    float sahCost;
 
 public:
-    BVH(std::vector<Object*>* objects, uint32_t leafSize = 4) : nNodes(0), nLeafs(0), leafSize(leafSize), build_prims(objects), flatTree(NULL) {
+//! Builds the tree of the primitives, which are reordered in leaf order (and not referenced afterwards).
+    BVH(std::vector<BVHPrimitive>* prims, const BVHBuildSettings& settings = BVHBuildSettings())
+        : nNodes(0), nLeafs(0), leafSize(settings.leafSize), build_prims(prims), settings(settings), sahCost(0.f), flatTree(NULL) {
 //        Stopwatch sw;
 
         // Build the tree based on the input object data set.
         build();
+        build_prims = NULL;
 
         // Output tree build time and statistics
 //        double constructionTime = sw.read();
@@ -134,62 +140,234 @@ public:
         uint32_t parent;
         // The range of objects in the object list covered by this node.
         uint32_t start, end;
+        // Depth of the node in the tree.
+        uint32_t depth;
     };
 
-/*! Build the BVH, given an input data set
+    // Below this depth, the SAH builder splits nodes at the object median so that the traversal stack
+    // cannot overflow.
+    static const uint32_t MaxSAHDepth = 64;
+
+    // Nodes with at least this many objects have their two subtrees built in parallel.
+    static const uint32_t ParallelBuildSize = 4096;
+
+    // Bounds and bins of nodes with at least this many objects are computed in parallel, by chunks of that size.
+    static const uint32_t ParallelBinSize = 16384;
+
+//! Runs func(a, b) over [start, end), in parallel chunks for large ranges, and returns the chunk results.
+    template<typename T, typename Func>
+    static std::vector<T> mapChunks(uint32_t start, uint32_t end, Func func) {
+        const uint32_t nbChunks = (end - start + ParallelBinSize - 1) / ParallelBinSize;
+        std::vector<T> results(nbChunks);
+        TinyRender::ThreadPool::ParallelFor(uint32_t(0), nbChunks, [&](uint32_t c) {
+            results[c] = func(start + c * ParallelBinSize, std::min(end, start + (c + 1) * ParallelBinSize));
+        }, uint32_t(1));
+        return results;
+    }
+
+//! Computes the bounds bb and the centroid bounds bc of the objects [start, end).
+    void computeBounds(uint32_t start, uint32_t end, BBox& bb, BBox& bc) const {
+        auto bound = [this](uint32_t a, uint32_t b) {
+            std::pair<BBox, BBox> bounds((*build_prims)[a].bbox, BBox((*build_prims)[a].centroid));
+            for(uint32_t p = a+1; p < b; ++p) {
+                bounds.first.expandToInclude( (*build_prims)[p].bbox);
+                bounds.second.expandToInclude( (*build_prims)[p].centroid);
+            }
+            return bounds;
+        };
+        if (end - start < ParallelBinSize) {
+            std::tie(bb, bc) = bound(start, end);
+            return;
+        }
+        const std::vector<std::pair<BBox, BBox>> chunks = mapChunks<std::pair<BBox, BBox>>(start, end, bound);
+        std::tie(bb, bc) = chunks[0];
+        for (size_t c = 1; c < chunks.size(); c++) {
+            bb.expandToInclude(chunks[c].first);
+            bc.expandToInclude(chunks[c].second);
+        }
+    }
+
+//! Finds the binned SAH split of the objects [start, end) with centroid bounds bc.
+//! Returns the first object of the right child after partitioning them, or start if a leaf is cheaper
+//! (or if no plane separates the centroids).
+    uint32_t splitSAH(uint32_t start, uint32_t end, const BBox& bb, const BBox& bc) {
+        struct Bin {
+            BBox bbox;
+            uint32_t count;
+        };
+        const uint32_t nbBins = std::max(2u, std::min(settings.nbBins, 256u));
+        const v3f empty(std::numeric_limits<float>::max());
+
+        // Bin centroids along the three axes at once, each object being queried once
+        v3f scale;
+        for (int a = 0; a < 3; a++) scale[a] = bc.extent[a] > 0.f ? nbBins / bc.extent[a] : 0.f;
+        auto getBin = [&](const v3f& c, int a) {
+            return std::min(nbBins - 1, uint32_t((c[a] - bc.min[a]) * scale[a]));
+        };
+        auto binRange = [&](uint32_t a, uint32_t b) {
+            std::vector<Bin> bins(3 * nbBins, Bin{BBox(empty, -empty), 0});
+            for (uint32_t p = a; p < b; ++p) {
+                const BVHPrimitive& prim = (*build_prims)[p];
+                const BBox& box = prim.bbox;
+                const v3f& c = prim.centroid;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (scale[axis] == 0.f) continue;
+                    Bin& bin = bins[axis * nbBins + getBin(c, axis)];
+                    bin.bbox.expandToInclude(box);
+                    bin.count++;
+                }
+            }
+            return bins;
+        };
+        std::vector<Bin> bins;
+        if (end - start < ParallelBinSize) {
+            bins = binRange(start, end);
+        } else {
+            const std::vector<std::vector<Bin>> chunks = mapChunks<std::vector<Bin>>(start, end, binRange);
+            bins = chunks[0];
+            for (size_t c = 1; c < chunks.size(); c++) {
+                for (size_t i = 0; i < bins.size(); i++) {
+                    bins[i].bbox.expandToInclude(chunks[c][i].bbox);
+                    bins[i].count += chunks[c][i].count;
+                }
+            }
+        }
+
+        // Sweep the planes between bins: right sides first, then left sides
+        const uint32_t nPrims = end - start;
+        float bestCost = settings.leafCost * nPrims;
+        int bestAxis = -1;
+        uint32_t bestBin = 0;
+        std::vector<float> rightCost(nbBins);
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] == 0.f) continue;
+            const Bin* axisBins = &bins[a * nbBins];
+            BBox box(empty, -empty);
+            uint32_t count = 0;
+            for (uint32_t i = nbBins - 1; i > 0; --i) {
+                box.expandToInclude(axisBins[i].bbox);
+                count += axisBins[i].count;
+                rightCost[i] = count ? box.surfaceArea() * count : -1.f;
+            }
+            box = BBox(empty, -empty);
+            count = 0;
+            for (uint32_t i = 1; i < nbBins; ++i) {
+                box.expandToInclude(axisBins[i - 1].bbox);
+                count += axisBins[i - 1].count;
+                if (count == 0 || rightCost[i] < 0.f) continue;
+                const float cost = settings.traversalCost
+                                   + settings.leafCost * (box.surfaceArea() * count + rightCost[i]) / bb.surfaceArea();
+                // Splits are forced on nodes larger than a leaf, even if they cost more
+                if (cost < bestCost || (bestAxis < 0 && nPrims > leafSize)) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestBin = i;
+                }
+            }
+        }
+        if (bestAxis < 0) return start;
+
+        auto mid = std::partition(build_prims->begin() + start, build_prims->begin() + end, [&](const BVHPrimitive& prim) {
+            return getBin(prim.centroid, bestAxis) < bestBin;
+        });
+        return uint32_t(mid - build_prims->begin());
+    }
+
+//! Splits the objects [start, end) at the centroid midpoint of the longest axis.
+//! Returns the first object of the right child after partitioning them, or start for a leaf.
+    uint32_t splitMidpoint(uint32_t start, uint32_t end, const BBox& bc) {
+        if (end - start <= leafSize) return start;
+
+        // Set the split dimensions
+        uint32_t split_dim = bc.maxDimension();
+
+        // Split on the center of the longest axis
+        float split_coord = .5f * (bc.min[split_dim] + bc.max[split_dim]);
+
+        // Partition the list of objects on this split
+        uint32_t mid = start;
+        for(uint32_t i=start;i<end;++i) {
+            if( (*build_prims)[i].centroid[split_dim] < split_coord ) {
+                std::swap( (*build_prims)[i], (*build_prims)[mid] );
+                ++mid;
+            }
+        }
+        return mid;
+    }
+
+//! Splits the objects [start, end) in two halves along the longest axis of their centroids.
+    uint32_t splitMedian(uint32_t start, uint32_t end, const BBox& bc) {
+        const uint32_t split_dim = bc.maxDimension();
+        const uint32_t mid = start + (end-start)/2;
+        std::nth_element(build_prims->begin() + start, build_prims->begin() + mid, build_prims->begin() + end,
+                         [split_dim](const BVHPrimitive& a, const BVHPrimitive& b) {
+            return a.centroid[split_dim] < b.centroid[split_dim];
+        });
+        return mid;
+    }
+
+//! Partitions the objects [start, end) of a node with the builder of the settings.
+//! Returns the first object of the right child, or start if the node is a leaf.
+    uint32_t split(uint32_t start, uint32_t end, uint32_t depth, const BBox& bb, const BBox& bc) {
+        const uint32_t nPrims = end - start;
+        uint32_t mid = start;
+        if (nPrims > 1) {
+            if (!settings.sah) mid = splitMidpoint(start, end, bc);
+            else if (depth < MaxSAHDepth) mid = splitSAH(start, end, bb, bc);
+            else mid = nPrims > leafSize ? splitMedian(start, end, bc) : start;
+        }
+
+        // If we get a bad split of a node too large for a leaf, just choose the center...
+        if(nPrims > leafSize && (mid == start || mid == end)) {
+            mid = start + (end-start)/2;
+        }
+        return mid;
+    }
+
+/*! Build the subtree of the objects [start, end) and append its nodes to buildnodes, depth first
+ *  (left child right after its parent, rightOffset relative to the parent).
  *  - Handling our own stack is quite a bit faster than the recursive style.
  *  - Each build stack entry's parent field eventually stores the offset
  *    to the parent of that node. Before that is finally computed, it will
  *    equal exactly three other values. (These are the magic values Untouched,
  *    Untouched-1, and TouchedTwice).
- *  - The partition here was also slightly faster than std::partition.
  */
-    void build()
+    void buildSubtree(uint32_t rootStart, uint32_t rootEnd, uint32_t rootDepth, std::vector<BVHFlatNode>& buildnodes)
     {
-        BVHBuildEntry todo[128];
-        uint32_t stackptr = 0;
+        std::vector<BVHBuildEntry> todo;
         const uint32_t Untouched    = 0xffffffff;
         const uint32_t TouchedTwice = 0xfffffffd;
 
         // Push the root
-        todo[stackptr].start = 0;
-        todo[stackptr].end = build_prims->size();
-        todo[stackptr].parent = 0xfffffffc;
-        stackptr++;
+        todo.push_back(BVHBuildEntry{0xfffffffc, rootStart, rootEnd, rootDepth});
 
         BVHFlatNode node;
-        std::vector<BVHFlatNode> buildnodes;
-        buildnodes.reserve(build_prims->size()*2);
 
-        while(stackptr > 0) {
+        while(!todo.empty()) {
             // Pop the next item off of the stack
-            BVHBuildEntry &bnode( todo[--stackptr] );
+            const BVHBuildEntry bnode = todo.back();
+            todo.pop_back();
             uint32_t start = bnode.start;
             uint32_t end = bnode.end;
             uint32_t nPrims = end - start;
 
-            nNodes++;
             node.start = start;
             node.nPrims = nPrims;
             node.rightOffset = Untouched;
 
             // Calculate the bounding box for this node
-            BBox bb( (*build_prims)[start]->getBBox());
-            BBox bc( (*build_prims)[start]->getCentroid());
-            for(uint32_t p = start+1; p < end; ++p) {
-                bb.expandToInclude( (*build_prims)[p]->getBBox());
-                bc.expandToInclude( (*build_prims)[p]->getCentroid());
-            }
+            BBox bb, bc;
+            computeBounds(start, end, bb, bc);
             node.bbox = bb;
 
-            // If the number of primitives at this point is less than the leaf
-            // size, then this will become a leaf. (Signified by rightOffset == 0)
-            if(nPrims <= leafSize) {
+            // Partition the objects, mid == start meaning that this node is a leaf (rightOffset == 0)
+            const uint32_t mid = split(start, end, bnode.depth, bb, bc);
+            if(mid == start) {
                 node.rightOffset = 0;
-                nLeafs++;
             }
 
             buildnodes.push_back(node);
+            const uint32_t index = uint32_t(buildnodes.size() - 1);
 
             // Child touches parent...
             // Special case: Don't do this for the root.
@@ -199,7 +377,7 @@ public:
                 // When this is the second touch, this is the right child.
                 // The right child sets up the offset for the flat tree.
                 if( buildnodes[bnode.parent].rightOffset == TouchedTwice ) {
-                    buildnodes[bnode.parent].rightOffset = nNodes - 1 - bnode.parent;
+                    buildnodes[bnode.parent].rightOffset = index - bnode.parent;
                 }
             }
 
@@ -207,37 +385,56 @@ public:
             if(node.rightOffset == 0)
                 continue;
 
-            // Set the split dimensions
-            uint32_t split_dim = bc.maxDimension();
-
-            // Split on the center of the longest axis
-            float split_coord = .5f * (bc.min[split_dim] + bc.max[split_dim]);
+            // Push right child, then left child
+            todo.push_back(BVHBuildEntry{index, mid, end, bnode.depth+1});
+            todo.push_back(BVHBuildEntry{index, start, mid, bnode.depth+1});
+        }
+    }
 
-            // Partition the list of objects on this split
-            uint32_t mid = start;
-            for(uint32_t i=start;i<end;++i) {
-                if( (*build_prims)[i]->getCentroid()[split_dim] < split_coord ) {
-                    std::swap( (*build_prims)[i], (*build_prims)[mid] );
-                    ++mid;
-                }
-            }
+//! Builds the subtree of the objects [start, end) like buildSubtree(), the two subtrees of large
+//! nodes being built as parallel tasks (they partition disjoint ranges of objects).
+    void buildParallel(uint32_t start, uint32_t end, uint32_t depth, std::vector<BVHFlatNode>& buildnodes) {
+        if (end - start < ParallelBuildSize) {
+            buildSubtree(start, end, depth, buildnodes);
+            return;
+        }
 
-            // If we get a bad split, just choose the center...
-            if(mid == start || mid == end) {
-                mid = start + (end-start)/2;
-            }
+        BVHFlatNode node;
+        BBox bc;
+        computeBounds(start, end, node.bbox, bc);
+        const uint32_t mid = split(start, end, depth, node.bbox, bc);
+        node.start = start;
+        node.nPrims = end - start;
+
+        std::vector<BVHFlatNode> children[2];
+        TinyRender::ThreadPool::ParallelFor(0, 2, [&](int i) {
+            if (i == 0) buildParallel(start, mid, depth + 1, children[0]);
+            else buildParallel(mid, end, depth + 1, children[1]);
+        }, 1);
+
+        node.rightOffset = uint32_t(1 + children[0].size());
+        buildnodes.push_back(node);
+        buildnodes.insert(buildnodes.end(), children[0].begin(), children[0].end());
+        buildnodes.insert(buildnodes.end(), children[1].begin(), children[1].end());
+    }
 
-            // Push right child
-            todo[stackptr].start = mid;
-            todo[stackptr].end = end;
-            todo[stackptr].parent = nNodes-1;
-            stackptr++;
-
-            // Push left child
-            todo[stackptr].start = start;
-            todo[stackptr].end = mid;
-            todo[stackptr].parent = nNodes-1;
-            stackptr++;
+//! Build the BVH, given an input data set.
+//! The top of the tree is built in parallel; the flattened layout is the same as a sequential build.
+    void build()
+    {
+        std::vector<BVHFlatNode> buildnodes;
+        buildnodes.reserve(build_prims->size()*2);
+        buildParallel(0, uint32_t(build_prims->size()), 0, buildnodes);
+
+        // Statistics, and SAH cost of the tree relative to the root area
+        nNodes = uint32_t(buildnodes.size());
+        nLeafs = 0;
+        const float rootArea = buildnodes[0].bbox.surfaceArea();
+        sahCost = 0.f;
+        for (const BVHFlatNode& n : buildnodes) {
+            nLeafs += n.rightOffset == 0;
+            const float cost = n.rightOffset == 0 ? settings.leafCost * n.nPrims : settings.traversalCost;
+            sahCost += rootArea > 0.f ? cost * n.bbox.surfaceArea() / rootArea : cost;
         }
 
         // Copy the temp node data to a flat array
@@ -251,19 +448,21 @@ public:
 
 public:
 
-//! - Compute the nearest intersection of all objects within the tree.
+//! - Traverse the tree, calling leaf(start, count, tMax) on every leaf the ray may hit before tMax.
+//!   The leaf function tests the primitives [start, start + count) in leaf order, lowers tMax to
+//!   the closest hit and returns whether it found one.
 //! - Return true if hit was found, false otherwise.
 //! - In the case where we want to find out of there is _ANY_ intersection at all,
 //!   set occlusion == true, in which case we exit on the first hit, rather
 //!   than find the closest.
-    bool getIntersection(const TinyRender::Ray& ray, IntersectionInfo* intersection, bool occlusion) const {
-        intersection->t = 999999999.f;
-        intersection->object = nullptr;
+    template<typename Leaf>
+    bool traverse(const TinyRender::Ray& ray, float tMax, Leaf leaf, bool occlusion = false) const {
         float bbhits[4] = {};
         int32_t closer, other;
+        bool found = false;
 
-        // Working set
-        BVHTraversal todo[64];
+        // Working set (deeper than the tree, see MaxSAHDepth)
+        BVHTraversal todo[128];
         int32_t stackptr = 0;
 
         // "Push" on the root node to the working set
@@ -278,28 +477,17 @@ public:
             const BVHFlatNode &node(flatTree[ ni ]);
 
             // If this node is further than the closest found intersection, continue
-            if(near > intersection->t)
+            if(near > tMax)
                 continue;
 
             // Is leaf -> Intersect
             if( node.rightOffset == 0 ) {
-                for(uint32_t o=0;o<node.nPrims;++o) {
-                    IntersectionInfo current;
-
-                    const Object* obj = (*build_prims)[node.start+o];
-                    bool hit = obj->getIntersection(ray, &current);
-
-                    if (hit) {
-                        // If we're only looking for occlusion, then any hit is good enough
-                        if(occlusion) {
-                            return true;
-                        }
-
-                        // Otherwise, keep the closest intersection only
-                        if (current.t < intersection->t) {
-                            *intersection = current;
-                        }
+                if (leaf(node.start, node.nPrims, tMax)) {
+                    // If we're only looking for occlusion, then any hit is good enough
+                    if(occlusion) {
+                        return true;
                     }
+                    found = true;
                 }
 
             } else { // Not a leaf
@@ -342,7 +530,20 @@ public:
             }
         }
 
-        return intersection->object != nullptr;
+        return found;
+    }
+
+//! Number of nodes and leaves of the tree.
+    uint32_t getNodeCount() const { return nNodes; }
+    uint32_t getLeafCount() const { return nLeafs; }
+
+//! Expected cost of tracing a ray through the tree under the surface area heuristic
+//! (with the costs of the settings, whichever builder was used).
+    float getSAHCost() const { return sahCost; }
+
+//! Bytes of the flattened tree.
+    size_t getMemoryUsage() const {
+        return nNodes * sizeof(BVHFlatNode);
     }
 
     ~BVH() {
@@ -75,6 +75,8 @@ struct DiffuseBSDF : BSDF {
         return val;
     }
 
+    size_t getMemoryUsage() const override { return albedo->getMemoryUsage(); }
+
     std::string toString() const override { return "Diffuse"; }
 };
 
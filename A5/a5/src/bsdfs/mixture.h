@@ -134,6 +134,10 @@ struct MixtureBSDF : BSDF {
         return val;
     }
 
+    size_t getMemoryUsage() const override {
+        return specularReflectance->getMemoryUsage() + diffuseReflectance->getMemoryUsage() + exponent->getMemoryUsage();
+    }
+
     std::string toString() const override { return "Mixture"; }
 };
 
@@ -119,6 +119,10 @@ struct PhongBSDF : BSDF {
         return val;
     }
 
+    size_t getMemoryUsage() const override {
+        return specularReflectance->getMemoryUsage() + diffuseReflectance->getMemoryUsage() + exponent->getMemoryUsage();
+    }
+
     std::string toString() const override { return "Phong"; }
 };
 
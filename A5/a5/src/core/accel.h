@@ -9,6 +9,7 @@
 
 #include "core.h"
 #include "bvh.h"
+#include "widebvh.h"
 
 TR_NAMESPACE_BEGIN
 
@@ -17,133 +18,164 @@ TR_NAMESPACE_BEGIN
  */
 struct AcceleratorBVH {
 
-    struct BVHNode : Object {
-
-        const size_t shapeID, faceID;
-        const WorldData& worldData;
-
-        BVHNode(size_t j, size_t i, const WorldData& d) : shapeID(j), faceID(i), worldData(d) { }
-
-        bool getIntersection(const Ray& ray, IntersectionInfo* intersection) const override {
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
-
-            float t, u, v;
-            if (rayTriangleIntersect(ray, v0, v1, v2, t, u, v)) {
-                if (t > 1e-3) {
-                    intersection->t = t;
-                    intersection->u = u;
-                    intersection->v = v;
-                    intersection->object = this;
-                    return true;
-                }
-            }
-            return false;
-        }
-
-        v3f getNormal(const IntersectionInfo&) const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.normals[3 * idx0.normal_index + 0], a.normals[3 * idx0.normal_index + 1],
-                            a.normals[3 * idx0.normal_index + 2]};
-            const v3f v1 = {a.normals[3 * idx1.normal_index + 0], a.normals[3 * idx1.normal_index + 1],
-                            a.normals[3 * idx1.normal_index + 2]};
-            const v3f v2 = {a.normals[3 * idx2.normal_index + 0], a.normals[3 * idx2.normal_index + 1],
-                            a.normals[3 * idx2.normal_index + 2]};
-
-            return glm::normalize(glm::cross(v1 - v0, v2 - v0));
-        }
-
-        BBox getBBox() const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
-
-            BBox b(v0);
-            b.expandToInclude(v1);
-            b.expandToInclude(v2);
-            return b;
-        }
-
-        v3f getCentroid() const override {
-            const tinyobj::mesh_t& m = worldData.shapes[shapeID].mesh;
-            const tinyobj::index_t& idx0 = m.indices[faceID + 0];
-            const tinyobj::index_t& idx1 = m.indices[faceID + 1];
-            const tinyobj::index_t& idx2 = m.indices[faceID + 2];
-
-            const tinyobj::attrib_t& a = worldData.attrib;
-            const v3f v0 = {a.vertices[3 * idx0.vertex_index + 0], a.vertices[3 * idx0.vertex_index + 1],
-                            a.vertices[3 * idx0.vertex_index + 2]};
-            const v3f v1 = {a.vertices[3 * idx1.vertex_index + 0], a.vertices[3 * idx1.vertex_index + 1],
-                            a.vertices[3 * idx1.vertex_index + 2]};
-            const v3f v2 = {a.vertices[3 * idx2.vertex_index + 0], a.vertices[3 * idx2.vertex_index + 1],
-                            a.vertices[3 * idx2.vertex_index + 2]};
-
-            return (v0 + v1 + v2) / 3.0f;
-        }
+    /**
+     * Triangle of the BVH leaves, with the edges of the ray-triangle test precomputed.
+     */
+    struct Triangle {
+        v3f v0, e1, e2;             // First vertex, v1 - v0 and v2 - v0
+        uint32_t shapeID, primID;
     };
 
     std::unique_ptr<BVH> bvh;
-    std::vector<Object*> objects;
+    std::unique_ptr<WideBVH<4>> bvh4;   // Collapsed trees, at most one of them is built
+    std::unique_ptr<WideBVH<8>> bvh8;
+    std::vector<Triangle> triangles;    // Packed in leaf order: leaves are ranges of this array
     const WorldData& worldData;
 
     explicit AcceleratorBVH(const WorldData& worldData) : worldData(worldData) { }
 
-    bool build() {
-        for (size_t j = 0; j < worldData.shapes.size(); j++) {
-            const tinyobj::shape_t& shape = worldData.shapes[j];
-            for (size_t i = 0; i < shape.mesh.indices.size(); i += 3)
-                objects.emplace_back(new BVHNode(j, i, worldData));
+    bool build(const Config::bvh_s& config) {
+        // Offset of the first triangle of each shape in the triangle list
+        std::vector<size_t> offsets(worldData.shapes.size() + 1, 0);
+        for (size_t j = 0; j < worldData.shapes.size(); j++)
+            offsets[j + 1] = offsets[j] + worldData.shapes[j].mesh.indices.size() / 3;
+
+        // Set up triangles and their build records in parallel (shapes, then faces within each shape)
+        const tinyobj::attrib_t& a = worldData.attrib;
+        std::vector<Triangle> shapeOrder(offsets.back());
+        std::vector<BVHPrimitive> prims(offsets.back());
+        ThreadPool::ParallelFor(size_t(0), worldData.shapes.size(), [&](size_t j) {
+            const tinyobj::mesh_t& m = worldData.shapes[j].mesh;
+            ThreadPool::ParallelFor(offsets[j], offsets[j + 1], [&](size_t k) {
+                const size_t i = 3 * (k - offsets[j]);
+                v3f v[3];
+                for (int c = 0; c < 3; c++) {
+                    const int vi = m.indices[i + c].vertex_index;
+                    v[c] = v3f(a.vertices[3 * vi + 0], a.vertices[3 * vi + 1], a.vertices[3 * vi + 2]);
+                }
+                shapeOrder[k] = Triangle{v[0], v[1] - v[0], v[2] - v[0], uint32_t(j), uint32_t(i / 3)};
+
+                BBox bbox(v[0]);
+                bbox.expandToInclude(v[1]);
+                bbox.expandToInclude(v[2]);
+                prims[k] = BVHPrimitive{bbox, (v[0] + v[1] + v[2]) / 3.0f, uint32_t(k)};
+            });
+        });
+        BVHBuildSettings settings;
+        settings.sah = config.builder == ESAHBVHBuilder;
+        settings.nbBins = uint32_t(config.bins);
+        settings.traversalCost = config.traversalCost;
+        settings.leafCost = config.leafCost;
+        bvh = std::unique_ptr<BVH>(new BVH(&prims, settings));
+
+        // The builder reordered the records: pack the triangles in the same order
+        triangles.resize(prims.size());
+        ThreadPool::ParallelFor(size_t(0), prims.size(), [&](size_t k) {
+            triangles[k] = shapeOrder[prims[k].index];
+        });
+
+        // Traverse the widest node format the CPU supports (4 children with SSE, or portable code off x86,
+        // 8 children with AVX2)
+        int width = config.width == 0 ? (hasAVX2() ? 8 : 4) : config.width;
+#if defined(TR_X86)
+        if (width == 8 && !hasAVX2()) {
+            std::cout << "AVX2 is not supported, using a 4-wide BVH" << std::endl;
+            width = 4;
+        }
+#endif
+        if (width == 8) {
+            bvh8 = std::unique_ptr<WideBVH<8>>(new WideBVH<8>());
+            if (!bvh8->collapse(bvh->flatTree)) bvh8.reset();
+        } else if (width == 4) {
+            bvh4 = std::unique_ptr<WideBVH<4>>(new WideBVH<4>());
+            if (!bvh4->collapse(bvh->flatTree)) bvh4.reset();
         }
-        bvh = std::unique_ptr<BVH>(new BVH(&objects));
         return true;
     }
 
+    // Children per node of the tree traversed
+    int getWidth() const {
+        return bvh8 ? 8 : bvh4 ? 4 : 2;
+    }
+
+    // Bytes of the triangles and of the trees
+    size_t getMemoryUsage() const {
+        return triangles.capacity() * sizeof(Triangle)
+               + (bvh ? bvh->getMemoryUsage() : 0)
+               + (bvh4 ? bvh4->nodes.capacity() * sizeof(WideBVH<4>::Node) : 0)
+               + (bvh8 ? bvh8->nodes.capacity() * sizeof(WideBVH<8>::Node) : 0);
+    }
+
+    /**
+     * Ray-triangle test of rayTriangleIntersect() on a packed triangle. Hits closer than 1e-3 are ignored.
+     */
+    static bool intersect(const Ray& r, const Triangle& tri, float& t, float& u, float& v) {
+        v3f pvec = glm::cross(r.d, tri.e2);
+        float det = glm::dot(tri.e1, pvec);
+        if (std::fabs(det) < Epsilon) return false;
+        float invDet = 1 / det;
+        v3f tvec = r.o - tri.v0;
+        u = glm::dot(tvec, pvec) * invDet;
+        if (u < 0 || u > 1) return false;
+        v3f qvec = glm::cross(tvec, tri.e1);
+        v = glm::dot(r.d, qvec) * invDet;
+        if (v < 0 || u + v > 1) return false;
+        t = glm::dot(tri.e2, qvec) * invDet;
+        return t > 1e-3;
+    }
+
+    /**
+     * Shadow-ray query: returns whether a triangle lies on the ray in [ray.min_t, tMax).
+     * Stops at the first triangle found, in any order, and computes no surface interaction.
+     */
+    bool occluded(const Ray& ray, float tMax) const {
+        auto leaf = [&](uint32_t start, uint32_t count, float& limit) {
+            for (uint32_t k = start; k < start + count; ++k) {
+                float t, u, v;
+                if (intersect(ray, triangles[k], t, u, v) && t < limit && t >= ray.min_t) return true;
+            }
+            return false;
+        };
+        return bvh8 ? bvh8->traverse(ray, tMax, leaf, true)
+               : bvh4 ? bvh4->traverse(ray, tMax, leaf, true)
+               : bvh->traverse(ray, tMax, leaf, true);
+    }
+
     bool intersect(const Ray& ray, SurfaceInteraction& info) const {
-        IntersectionInfo iInfo{};
-        iInfo.object = nullptr;
         const std::vector<tinyobj::shape_t>& ss = worldData.shapes;
         const tinyobj::attrib_t& sa = worldData.attrib;
 
-        if (bvh->getIntersection(ray, &iInfo, false)) {
-            info.t = iInfo.t;
-            if (iInfo.t <= ray.max_t && iInfo.t >= ray.min_t) {
-                const tinyobj::shape_t& s = ss[((BVHNode*) (iInfo.object))->shapeID];
-                const size_t i = ((BVHNode*) (iInfo.object))->faceID;
+        // Closest hit of the triangles of a leaf
+        float tHit = 999999999.f, uHit = 0.f, vHit = 0.f;
+        uint32_t triHit = 0;
+        auto leaf = [&](uint32_t start, uint32_t count, float& tMax) {
+            bool hit = false;
+            for (uint32_t k = start; k < start + count; ++k) {
+                float t, u, v;
+                if (intersect(ray, triangles[k], t, u, v) && t < tMax) {
+                    tMax = tHit = t;
+                    uHit = u;
+                    vHit = v;
+                    triHit = k;
+                    hit = true;
+                }
+            }
+            return hit;
+        };
+        const bool hit = bvh8 ? bvh8->traverse(ray, tHit, leaf)
+                         : bvh4 ? bvh4->traverse(ray, tHit, leaf)
+                         : bvh->traverse(ray, tHit, leaf);
+
+        if (hit) {
+            info.t = tHit;
+            if (tHit <= ray.max_t && tHit >= ray.min_t) {
+                const Triangle& tri = triangles[triHit];
+                const tinyobj::shape_t& s = ss[tri.shapeID];
+                const size_t i = 3 * size_t(tri.primID);
                 const tinyobj::index_t& idx0 = s.mesh.indices[i + 0];
                 const tinyobj::index_t& idx1 = s.mesh.indices[i + 1];
                 const tinyobj::index_t& idx2 = s.mesh.indices[i + 2];
 
-                const v3f v0 = {sa.vertices[3 * idx0.vertex_index + 0], sa.vertices[3 * idx0.vertex_index + 1],
-                                sa.vertices[3 * idx0.vertex_index + 2]};
-                const v3f v1 = {sa.vertices[3 * idx1.vertex_index + 0], sa.vertices[3 * idx1.vertex_index + 1],
-                                sa.vertices[3 * idx1.vertex_index + 2]};
-                const v3f v2 = {sa.vertices[3 * idx2.vertex_index + 0], sa.vertices[3 * idx2.vertex_index + 1],
-                                sa.vertices[3 * idx2.vertex_index + 2]};
-
                 const v3f n0 = {sa.normals[3 * idx0.normal_index + 0], sa.normals[3 * idx0.normal_index + 1],
                                 sa.normals[3 * idx0.normal_index + 2]};
                 const v3f n1 = {sa.normals[3 * idx1.normal_index + 0], sa.normals[3 * idx1.normal_index + 1],
@@ -151,13 +183,13 @@ struct AcceleratorBVH {
                 const v3f n2 = {sa.normals[3 * idx2.normal_index + 0], sa.normals[3 * idx2.normal_index + 1],
                                 sa.normals[3 * idx2.normal_index + 2]};
 
-                info.shapeID = ((BVHNode*) (iInfo.object))->shapeID;
-                info.primID = ((BVHNode*) (iInfo.object))->faceID / 3;
-                info.t = iInfo.t;
-                info.u = iInfo.u;
-                info.v = iInfo.v;
-                info.p = barycentric(v0, v1, v2, iInfo.u, iInfo.v);
-                info.frameNg = Frame(glm::normalize(glm::cross(v1 - v0, v2 - v0)));
+                info.shapeID = tri.shapeID;
+                info.primID = tri.primID;
+                info.t = tHit;
+                info.u = uHit;
+                info.v = vHit;
+                info.p = tri.v0 + uHit * tri.e1 + vHit * tri.e2;
+                info.frameNg = Frame(glm::normalize(glm::cross(tri.e1, tri.e2)));
                 info.frameNs = Frame(glm::normalize(barycentric(n0, n1, n2, info.u, info.v)));
                 info.wo = info.frameNs.toLocal(-ray.d);
                 info.matID = s.mesh.material_ids[info.primID];
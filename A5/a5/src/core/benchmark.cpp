@@ -0,0 +1,157 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/benchmark.h>
+#include <core/jobs.h>
+#include <core/renderer.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Cache event counters of the whole process.
+ * Counters are inherited by the threads created after they are opened, and the counts of a thread
+ * are only added to the total when it exits: the thread pool is restarted around the measure.
+ * LLC references are the accesses that missed the L2 cache, generic perf events have no L2 counter.
+ */
+struct CacheCounters {
+    enum { EL1DMisses = 0, ELLCReferences, ELLCMisses, ECounters };
+    int fd[ECounters];
+
+    CacheCounters() {
+        for (int& f : fd) f = -1;
+    }
+
+    ~CacheCounters() {
+#if defined(__linux__)
+        for (int f : fd) if (f >= 0) ::close(f);
+#endif
+    }
+
+    // Opens the counters, then restarts the pool so that its workers inherit them
+    void start() {
+#if defined(__linux__)
+        const uint64_t configs[ECounters] = {
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16),
+            PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+        for (int i = 0; i < ECounters; i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = configs[i];
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[i] = int(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+        ThreadPool::setThreadCount(ThreadPool::getThreadCount());
+    }
+
+    // Joins the workers so that their counts are added, then stops counting
+    void stop() {
+        ThreadPool::setThreadCount(ThreadPool::getThreadCount());
+#if defined(__linux__)
+        for (int f : fd) if (f >= 0) ::ioctl(f, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    // Count of a counter, or -1 if it is not supported
+    long long read(int i) const {
+        long long value = -1;
+#if defined(__linux__)
+        if (fd[i] < 0 || ::read(fd[i], &value, sizeof(value)) != ssize_t(sizeof(value))) return -1;
+#endif
+        return value;
+    }
+};
+
+static std::string formatCount(long long count) {
+    if (count < 0) return "n/a";
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.2fM", count / 1e6);
+    return text;
+}
+
+bool runTileBenchmark(const std::vector<std::string>& inputs) {
+    const ETileOrder orders[] = {EScanlineTileOrder, EMortonTileOrder, EHilbertTileOrder};
+    const char* orderNames[] = {"scanline", "morton", "hilbert"};
+    const int tileSizes[] = {8, 16, 32, 64};
+    SceneCache cache;
+    bool ok = true;
+
+    for (const std::string& file : inputs) {
+        Config config;
+        try {
+            if (loadTOML(config, file)) {
+                std::cerr << "Error: " << file << " is a real-time scene, skipping it" << std::endl;
+                ok = false;
+                continue;
+            }
+        } catch (std::exception const& e) {
+            std::cerr << "Error while parsing scene file " << file << ": " << e.what() << std::endl;
+            ok = false;
+            continue;
+        }
+        config.progressive.enabled = config.adaptive.enabled = false;
+        config.checkpoint.interval = 0.f;
+
+        // Load the scene and build its BVH once, outside of the measures
+        std::shared_ptr<SceneData> data = cache.get(config);
+        Scene scene(config, data);
+        if (!scene.load(false)) {
+            std::cerr << "Error: cannot load " << config.objFile.string() << ", skipping " << file << std::endl;
+            ok = false;
+            continue;
+        }
+
+        std::cout << "\n" << file << ": " << config.width << "x" << config.height << ", " << config.spp << " spp, "
+                  << ThreadPool::getThreadCount() << " threads" << std::endl;
+        std::printf("  %-9s %5s %9s %12s %10s %10s %10s\n",
+                    "order", "tile", "time (s)", "Msamples/s", "L1D miss", "LLC ref", "LLC miss");
+
+        const double nbSamples = double(config.width) * config.height * config.spp;
+        for (int tileSize : tileSizes) {
+            for (int k = 0; k < 3; k++) {
+                config.tiling.size = tileSize;
+                config.tiling.order = orders[k];
+                Renderer renderer(config, data);
+                if (!renderer.init(false, true)) return false;
+
+                CacheCounters counters;
+                counters.start();
+                const auto start = std::chrono::steady_clock::now();
+                renderer.render();
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                counters.stop();
+
+                std::printf("  %-9s %5d %9.3f %12.3f %10s %10s %10s\n", orderNames[k], tileSize, seconds,
+                            nbSamples / seconds / 1e6,
+                            formatCount(counters.read(CacheCounters::EL1DMisses)).c_str(),
+                            formatCount(counters.read(CacheCounters::ELLCReferences)).c_str(),
+                            formatCount(counters.read(CacheCounters::ELLCMisses)).c_str());
+                std::fflush(stdout);
+            }
+        }
+        cache.release(config);
+    }
+    return ok;
+}
+
+TR_NAMESPACE_END
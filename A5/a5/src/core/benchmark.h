@@ -0,0 +1,23 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Tile traversal benchmark.
+ * Renders each off-line scene given with every tile order (scanline, Morton, Hilbert) and
+ * a few tile sizes, and reports the throughput along with the cache misses measured by
+ * the hardware counters (Linux perf events, when available). No image is saved.
+ */
+bool runTileBenchmark(const std::vector<std::string>& inputs);
+
+TR_NAMESPACE_END
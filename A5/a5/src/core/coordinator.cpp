@@ -0,0 +1,317 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/coordinator.h>
+#include <core/daemon.h>
+#include <core/jobs.h>
+#include <core/net.h>
+#include <core/renderer.h>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+#if defined(_WIN32)
+
+bool runCoordinator(const std::string&, const std::string&, int, std::string, float) {
+    std::cerr << "Error: multi-process rendering is not supported on this platform" << std::endl;
+    return false;
+}
+
+bool runWorker(const std::string&) {
+    std::cerr << "Error: multi-process rendering is not supported on this platform" << std::endl;
+    return false;
+}
+
+#else
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Coordinator side of a worker connection.
+ */
+struct WorkerConnection {
+    std::unique_ptr<Socket> socket;
+    int capacity = 0;                               // Tiles kept in flight (0 until the worker loaded the scene)
+    std::map<int, Clock::time_point> inFlight;      // Tiles sent to the worker and not returned yet
+};
+
+static float secondsSince(const Clock::time_point& t) {
+    return std::chrono::duration<float>(Clock::now() - t).count();
+}
+
+static bool isReadable(const Socket& socket) {
+    pollfd fd = {socket.fd, POLLIN, 0};
+    return ::poll(&fd, 1, 0) > 0;
+}
+
+static pid_t spawnWorker(const std::string& executable, const std::string& socketPath, int nbThreads) {
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        const std::string threads = std::to_string(nbThreads);
+        ::execlp(executable.c_str(), executable.c_str(), "--worker", socketPath.c_str(),
+                 "--threads", threads.c_str(), (char*) nullptr);
+        std::cerr << "Error: cannot start worker " << executable << std::endl;
+        ::_exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+bool runCoordinator(const std::string& inputFile, const std::string& executable,
+                    int nbWorkers, std::string socketPath, float stallTimeout) {
+    if (socketPath.empty()) {
+        socketPath = (fs::temp_directory_path() / ("tinyrender-" + std::to_string(::getpid()) + ".sock")).string();
+    }
+
+    Config config;
+    try {
+        if (loadTOML(config, inputFile)) {
+            std::cerr << "Error: real-time scenes cannot be distributed" << std::endl;
+            return false;
+        }
+    } catch (std::exception const& e) {
+        std::cerr << "Error while parsing scene file: " << e.what() << std::endl;
+        return false;
+    }
+    if (config.progressive.enabled || config.adaptive.enabled) {
+        std::cout << "Warning: progressive and adaptive settings are ignored by multi-process renders" << std::endl;
+    }
+
+    const std::vector<char> job = makeJob(inputFile);
+    const Config::crop_s& crop = config.crop;
+    const std::vector<Tile> tiles = crop.enabled
+        ? Renderer::buildTiles(crop.x0, crop.y0, crop.x1, crop.y1, config.tiling.size, config.tiling.order)
+        : Renderer::buildTiles(0, 0, config.width, config.height, config.tiling.size, config.tiling.order);
+    std::unique_ptr<v3f[]> rgb(new v3f[config.width * config.height]);
+    std::vector<bool> done(tiles.size(), false);
+    std::map<int, Clock::time_point> lastAssigned;
+    std::deque<int> pending;
+    for (const Tile& tile : tiles) pending.push_back(tile.index);
+    size_t nbDone = 0, nbReported = 0;
+    float tileTimeSum = 0.f;
+    int nbTimed = 0;
+
+    std::unique_ptr<Socket> server = Socket::listen(socketPath);
+    if (!server->isValid()) return false;
+
+    // Split the cores between the local workers
+    const unsigned nbCores = std::max(1u, std::thread::hardware_concurrency());
+    const int threadsPerWorker = std::max(1, int(nbCores) / std::max(1, nbWorkers));
+    std::vector<pid_t> children;
+    for (int i = 0; i < nbWorkers; i++) {
+        children.push_back(spawnWorker(executable, socketPath, threadsPerWorker));
+    }
+    std::cout << "Coordinator: " << tiles.size() << " tiles, " << nbWorkers << " workers ("
+              << threadsPerWorker << " threads each) on " << socketPath << std::endl;
+
+    std::vector<std::unique_ptr<WorkerConnection>> workers;
+    const Clock::time_point start = Clock::now();
+    bool ok = true;
+
+    while (nbDone < tiles.size()) {
+        // 1) Wait for new workers or returned tiles
+        std::vector<pollfd> fds(1 + workers.size());
+        fds[0] = {server->fd, POLLIN, 0};
+        for (size_t k = 0; k < workers.size(); k++) fds[k + 1] = {workers[k]->socket->fd, POLLIN, 0};
+        ::poll(fds.data(), fds.size(), 100);
+
+        if (fds[0].revents & POLLIN) {
+            std::unique_ptr<WorkerConnection> worker(new WorkerConnection());
+            worker->socket = server->accept();
+            if (worker->socket->isValid() && worker->socket->send(EMsgJob, job.data(), job.size())) {
+                workers.push_back(std::move(worker));
+            }
+        }
+
+        // 2) Collect results. A worker that fails or disconnects gives its tiles back.
+        for (size_t k = 0; k + 1 < fds.size(); k++) {
+            if (!(fds[k + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            WorkerConnection& worker = *workers[k];
+            uint32_t type;
+            std::vector<char> payload;
+            bool alive = worker.socket->receive(type, payload);
+
+            if (alive && type == EMsgBegin && payload.size() >= 3 * sizeof(int32_t)) {
+                int32_t info[3];
+                std::memcpy(info, payload.data(), sizeof(info));
+                worker.capacity = 2 * std::max(1, int(info[2]));
+            }
+            else if (alive && type == EMsgTile) {
+                const int index = receiveTile(payload, rgb.get(), config.width, config.height);
+                if (index < 0 || index >= int(tiles.size())) {
+                    alive = false;
+                } else {
+                    auto it = worker.inFlight.find(index);
+                    if (it != worker.inFlight.end()) {
+                        tileTimeSum += secondsSince(it->second);
+                        nbTimed++;
+                        worker.inFlight.erase(it);
+                    }
+                    if (!done[index]) {
+                        done[index] = true;
+                        nbDone++;
+                    }
+                }
+            }
+            else {
+                if (alive && type == EMsgError) {
+                    std::cerr << "Worker error: " << std::string(payload.begin(), payload.end()) << std::endl;
+                }
+                alive = false;
+            }
+
+            if (!alive) {
+                for (const auto& t : worker.inFlight) {
+                    if (!done[t.first]) pending.push_front(t.first);
+                }
+                worker.inFlight.clear();
+                worker.socket->close();
+            }
+        }
+        workers.erase(std::remove_if(workers.begin(), workers.end(), [](const std::unique_ptr<WorkerConnection>& w) {
+            return !w->socket->isValid();
+        }), workers.end());
+
+        // 3) Reassign stalled tiles, the first copy to come back wins.
+        // Without a fixed timeout, a tile is stalled once it took 8x the mean tile time.
+        const float timeout = stallTimeout > 0.f ? stallTimeout
+                            : nbTimed > 0 ? std::max(1.f, 8.f * tileTimeSum / nbTimed) : 0.f;
+        for (const auto& worker : workers) {
+            for (const auto& t : worker->inFlight) {
+                if (timeout <= 0.f || done[t.first] || secondsSince(lastAssigned[t.first]) < timeout) continue;
+                if (std::find(pending.begin(), pending.end(), t.first) != pending.end()) continue;
+                std::cout << "\nTile " << t.first << " stalled, reassigning it" << std::endl;
+                pending.push_front(t.first);
+            }
+        }
+
+        // 4) Keep every ready worker busy
+        for (const auto& worker : workers) {
+            std::vector<int> skipped;
+            while (int(worker->inFlight.size()) < worker->capacity && !pending.empty()) {
+                const int index = pending.front();
+                pending.pop_front();
+                if (done[index]) continue;
+                if (worker->inFlight.count(index)) {
+                    skipped.push_back(index); // Already stalled on this worker
+                    continue;
+                }
+                const int32_t message = index;
+                if (!worker->socket->send(EMsgRenderTile, &message, sizeof(message))) {
+                    pending.push_front(index); // The disconnection is handled at the next poll
+                    break;
+                }
+                worker->inFlight[index] = lastAssigned[index] = Clock::now();
+            }
+            pending.insert(pending.begin(), skipped.begin(), skipped.end());
+        }
+
+        // 5) Give up once no worker is left
+        if (workers.empty()) {
+            bool anyAlive = false;
+            for (pid_t& pid : children) {
+                if (pid > 0 && ::waitpid(pid, nullptr, WNOHANG) == 0) anyAlive = true;
+                else pid = -1;
+            }
+            if (!anyAlive) {
+                std::cerr << "Error: all workers are gone, " << tiles.size() - nbDone << " tiles left" << std::endl;
+                ok = false;
+                break;
+            }
+        }
+
+        if (nbDone != nbReported) {
+            std::cout << "\rTiles " << nbDone << "/" << tiles.size() << " (" << workers.size() << " workers)" << std::flush;
+            nbReported = nbDone;
+        }
+    }
+    std::cout << std::endl;
+
+    // Closing the connections ends the workers, stalled ones are killed
+    workers.clear();
+    server.reset();
+    ::unlink(socketPath.c_str());
+    for (pid_t pid : children) {
+        if (pid <= 0) continue;
+        for (int i = 0; i < 100 && ::waitpid(pid, nullptr, WNOHANG) == 0; i++) ::usleep(10000);
+        if (::kill(pid, 0) == 0) {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, nullptr, 0);
+        }
+    }
+
+    if (ok) {
+        std::cout << "Multi-process render done in " << secondsSince(start) << "s" << std::endl;
+        fs::path p = config.tomlFile;
+        Integrator::saveImage(config, rgb, p.replace_extension("exr"));
+    }
+    return ok;
+}
+
+bool runWorker(const std::string& socketPath) {
+    std::unique_ptr<Socket> socket = Socket::connect(socketPath);
+    uint32_t type;
+    std::vector<char> payload;
+    if (!socket->isValid() || !socket->receive(type, payload) || type != EMsgJob) {
+        std::cerr << "Error: no job from coordinator " << socketPath << std::endl;
+        return false;
+    }
+
+    Config config;
+    std::string error;
+    if (!parseJob(payload, config, error)) {
+        socket->send(EMsgError, error.data(), error.size());
+        return false;
+    }
+    Renderer renderer(config);
+    if (!renderer.init(false, true)) {
+        error = "Cannot load scene " + config.objFile.string();
+        socket->send(EMsgError, error.data(), error.size());
+        return false;
+    }
+    renderer.setupOffline();
+    std::vector<int> position(renderer.tiles.size());
+    for (size_t i = 0; i < renderer.tiles.size(); i++) position[renderer.tiles[i].index] = int(i);
+    renderer.onTileDone = [&](const Tile& tile) {
+        sendTile(*socket, tile, *renderer.integrator->rgb);
+    };
+
+    const int32_t info[3] = {config.width, config.height, int32_t(ThreadPool::getThreadCount())};
+    socket->send(EMsgBegin, info, sizeof(info));
+
+    // Render the tiles received so far in parallel, until the coordinator hangs up
+    while (socket->receive(type, payload)) {
+        std::vector<int> batch;
+        do {
+            int32_t index;
+            if (type != EMsgRenderTile || payload.size() != sizeof(index)) return false;
+            std::memcpy(&index, payload.data(), sizeof(index));
+            if (index >= 0 && index < int(renderer.tiles.size())) batch.push_back(position[index]);
+        } while (isReadable(*socket) && socket->receive(type, payload));
+
+        ThreadPool::ParallelFor(0, int(batch.size()), [&](int i) {
+            const Tile& tile = renderer.tiles[batch[i]];
+            renderer.renderFullTile(tile);
+            renderer.finishTile(tile);
+        }, 1);
+    }
+    return true;
+}
+
+#endif
+
+TR_NAMESPACE_END
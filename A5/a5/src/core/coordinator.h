@@ -0,0 +1,32 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Multi-process rendering coordinator.
+ * Spawns nbWorkers worker processes (more can connect to socketPath, a temporary path if empty),
+ * hands them tiles of the film and merges the returned tiles into the final EXR image. Tiles that do not come back within
+ * stallTimeout seconds (0 picks a timeout from the observed tile times) are handed to another worker,
+ * and the tiles of a worker that disconnects are reassigned.
+ * Samples are keyed on their pixel and index only, so the image matches a single-process render.
+ */
+bool runCoordinator(const std::string& inputFile, const std::string& executable,
+                    int nbWorkers, std::string socketPath, float stallTimeout);
+
+/**
+ * Multi-process rendering worker.
+ * Connects to a coordinator, loads the scene it sends and renders the tiles it asks for.
+ */
+bool runWorker(const std::string& socketPath);
+
+TR_NAMESPACE_END
@@ -9,13 +9,14 @@
 
 #include <GL/glew.h>
 #include <functional>
+#include <map>
 #include "platform.h"
 #include "math.h"
 #include "utils.h"
 #include "cpptoml.h"
 #include "tiny_obj_loader.h"
 #include "camera.h"
-#include <thread>
+#include "threadpool.h"
 
 TR_NAMESPACE_BEGIN
 
@@ -62,6 +63,35 @@ enum EBSDF {
     EBSDFs
 };
 
+/**
+ * Order in which the tiles of an off-line render are handed to threads.
+ * Space-filling curves keep consecutive tiles adjacent, so threads working
+ * on nearby tiles share more of the geometry they touch in cache.
+ */
+enum ETileOrder {
+    EScanlineTileOrder = 0,
+    EMortonTileOrder,
+    EHilbertTileOrder
+};
+
+/**
+ * Distribution of the camera samples of a pixel over its footprint.
+ * Every pattern is randomized per pixel, so each sample stays uniform over the pixel.
+ */
+enum EPixelJitter {
+    ERandomJitter = 0,      // Independent uniform samples
+    EStratifiedJitter,      // One sample per cell of a sqrt(spp) x sqrt(spp) grid, in a per-pixel rotated order
+    ESobolJitter            // (0,2)-sequence (first two Sobol dimensions) with a per-pixel toroidal shift
+};
+
+/**
+ * BVH builder enumeration.
+ */
+enum EBVHBuilder {
+    EMidpointBVHBuilder = 0,    // Split at the centroid midpoint of the longest axis: fastest build
+    ESAHBVHBuilder              // Binned surface area heuristic: fastest traversal
+};
+
 // Forward declarations
 struct Scene;
 struct WorldData;
@@ -144,6 +174,165 @@ struct RenderBuffer {
     }
 };
 
+/**
+ * Accumulation buffer.
+ * Stores per-pixel sums of radiance samples along with the number of samples taken,
+ * so that pixels can be refined independently (progressive and adaptive rendering).
+ * A running mean and variance of the sample luminance (Welford) estimates per-pixel noise.
+ */
+struct AccumulationBuffer {
+    int width, height;
+    std::unique_ptr<v3f[]> sum;
+    std::unique_ptr<uint32_t[]> count;
+    std::unique_ptr<float[]> lumMean, lumM2;
+    AccumulationBuffer(int w, int h) : width(w), height(h) {
+        sum = std::unique_ptr<v3f[]>(new v3f[width * height]);
+        count = std::unique_ptr<uint32_t[]>(new uint32_t[width * height]);
+        lumMean = std::unique_ptr<float[]>(new float[width * height]);
+        lumM2 = std::unique_ptr<float[]>(new float[width * height]);
+        clear();
+    }
+    void addSample(int i, const v3f& color) {
+        sum[i] += color;
+        count[i]++;
+        const float l = getLuminance(color);
+        const float delta = l - lumMean[i];
+        lumMean[i] += delta / count[i];
+        lumM2[i] += delta * (l - lumMean[i]);
+    }
+    void clear() {
+        for (int i = 0; i < height * width; i++) {
+            sum[i] = v3f(0.f);
+            count[i] = 0;
+            lumMean[i] = 0.f;
+            lumM2[i] = 0.f;
+        }
+    }
+    // Relative standard error of the luminance estimate of a pixel (infinite until 2 samples are taken)
+    float getRelativeError(int i) const {
+        if (count[i] < 2) return std::numeric_limits<float>::infinity();
+        const float variance = lumM2[i] / (count[i] - 1);
+        return std::sqrt(variance / count[i]) / (lumMean[i] + 1e-3f);
+    }
+    // Per-pixel average (black where no sample was taken yet)
+    v3f getAverage(int i) const {
+        return count[i] > 0 ? sum[i] * (1.f / count[i]) : v3f(0.f);
+    }
+    void resolve(RenderBuffer& out) const {
+        for (int i = 0; i < height * width; i++) {
+            out.data[i] = getAverage(i);
+        }
+    }
+    // Smallest sample count over the pixels [x0, x1) x [y0, y1)
+    uint32_t getMinCount(int x0, int y0, int x1, int y1) const {
+        uint32_t n = std::numeric_limits<uint32_t>::max();
+        for (int y = y0; y < y1; y++) {
+            n = std::min(n, *std::min_element(count.get() + y * width + x0, count.get() + y * width + x1));
+        }
+        return n;
+    }
+};
+
+/**
+ * Splat buffer.
+ * Accumulates radiance that concurrent threads splat to arbitrary pixels (light tracing, BDPT).
+ * Every thread writes to its own layer of blocks of blockSize x blockSize pixels, allocated on
+ * first use, so splats never contend; merge() sums all layers into a RenderBuffer at the end.
+ */
+struct SplatBuffer {
+    static const int blockSize = 16;
+    int width, height, nbBlocksX, nbBlocksY;
+
+    // Blocks written by one thread
+    struct Layer {
+        std::vector<std::unique_ptr<v3f[]>> blocks;
+    };
+
+    SplatBuffer(int w, int h) : width(w), height(h), id(nextId()++) {
+        nbBlocksX = (width + blockSize - 1) / blockSize;
+        nbBlocksY = (height + blockSize - 1) / blockSize;
+    }
+
+    void splat(int x, int y, const v3f& v) {
+        if (x < 0 || y < 0 || x >= width || y >= height) return;
+        std::unique_ptr<v3f[]>& block = getLayer().blocks[(y / blockSize) * nbBlocksX + x / blockSize];
+        if (!block) {
+            block = std::unique_ptr<v3f[]>(new v3f[blockSize * blockSize]);
+            std::fill(block.get(), block.get() + blockSize * blockSize, v3f(0.f));
+        }
+        block[(y % blockSize) * blockSize + x % blockSize] += v;
+    }
+
+    // Bytes of the blocks allocated so far. Must not run concurrently with splat().
+    size_t getMemoryUsage() const {
+        size_t bytes = 0;
+        for (const auto& layer : layers) {
+            bytes += layer.second->blocks.capacity() * sizeof(std::unique_ptr<v3f[]>);
+            for (const auto& block : layer.second->blocks) {
+                if (block) bytes += blockSize * blockSize * sizeof(v3f);
+            }
+        }
+        return bytes;
+    }
+
+    // Adds scale times the splatted radiance to out. merge() and clear() must not run concurrently with splat().
+    void merge(RenderBuffer& out, float scale) const {
+        for (const auto& layer : layers) {
+            for (int b = 0; b < nbBlocksX * nbBlocksY; b++) {
+                const v3f* block = layer.second->blocks[b].get();
+                if (!block) continue;
+                const int x0 = (b % nbBlocksX) * blockSize, y0 = (b / nbBlocksX) * blockSize;
+                for (int y = y0; y < std::min(y0 + blockSize, height); y++) {
+                    for (int x = x0; x < std::min(x0 + blockSize, width); x++) {
+                        out.data[y * width + x] += scale * block[(y - y0) * blockSize + x - x0];
+                    }
+                }
+            }
+        }
+    }
+
+    bool isEmpty() const {
+        return layers.empty();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        layers.clear();
+        id = nextId()++; // Invalidates the layers cached by threads
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::thread::id, std::unique_ptr<Layer>> layers;
+    uint64_t id;
+
+    static std::atomic<uint64_t>& nextId() {
+        static std::atomic<uint64_t> counter(1);
+        return counter;
+    }
+
+    // Layer of the calling thread. The last buffer a thread splatted to is cached, so the lock is
+    // only taken when a thread starts splatting to a buffer.
+    Layer& getLayer() {
+        struct Cache {
+            uint64_t id = 0;
+            Layer* layer = nullptr;
+        };
+        static thread_local Cache cache;
+        if (cache.id == id) return *cache.layer;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Layer>& layer = layers[std::this_thread::get_id()];
+        if (!layer) {
+            layer = std::unique_ptr<Layer>(new Layer());
+            layer->blocks.resize(size_t(nbBlocksX * nbBlocksY));
+        }
+        cache.id = id;
+        cache.layer = layer.get();
+        return *layer;
+    }
+};
+
 /**
  * Coordinate frame structure.
  * Stores canonical frame and transforms.
@@ -187,6 +376,112 @@ struct Camera {
     float fov;
 };
 
+/**
+ * Camera keyframe of an animation.
+ */
+struct CameraKeyframe {
+    float frame;
+    Camera camera;
+};
+
+/**
+ * Pinhole camera of off-line renders.
+ * The camera basis and the per-pixel ray increments are precomputed, so a primary ray direction is
+ * two multiply-adds and a normalization away from its film position.
+ */
+struct PinholeCamera {
+    static const int MaxBatch = 16;     // Directions generated per call of generateDirections()
+
+    v3f eye;
+    v3f corner;         // Unnormalized direction through the top-left corner of the film
+    v3f dx, dy;         // Change of the direction per pixel along x and y
+    EPixelJitter jitter = ERandomJitter;
+    int strata = 1;     // Cells per side of the stratified grid
+
+    PinholeCamera() = default;
+
+    PinholeCamera(const Camera& camera, int width, int height, int spp, EPixelJitter jitter)
+        : eye(camera.o), jitter(jitter) {
+        const v3f f = glm::normalize(camera.at - camera.o);
+        const v3f s = glm::normalize(glm::cross(f, camera.up));
+        const v3f u = glm::cross(s, f);
+        const float scaling = std::tan((float(M_PI) * camera.fov / 180.f) / 2.f);
+        const float aspectRatio = float(width) / float(height);
+        corner = f - s * (scaling * aspectRatio) + u * scaling;
+        dx = s * (2.f * scaling * aspectRatio / float(width));
+        dy = u * (-2.f * scaling / float(height));
+        strata = std::max(1, int(std::ceil(std::sqrt(float(spp)))));
+    }
+
+    /**
+     * Position within its pixel of a camera sample.
+     * Leaves the sampler at the first dimension after the jitter (2) of that sample.
+     */
+    p2f sampleJitter(Sampler& sampler, uint32_t pixel, uint32_t sampleIndex) const {
+        if (jitter == ERandomJitter) {
+            sampler.startPixelSample(pixel, sampleIndex);
+            return sampler.next2D();
+        }
+
+        // Per-pixel randomization, drawn from a stream no camera sample uses
+        sampler.startPixelSample(pixel, std::numeric_limits<uint32_t>::max());
+        const p2f shift = sampler.next2D();
+        sampler.startPixelSample(pixel, sampleIndex);
+        if (jitter == EStratifiedJitter) {
+            const uint32_t nbCells = uint32_t(strata * strata);
+            const uint32_t cell = (sampleIndex + uint32_t(shift.x * nbCells)) % nbCells;
+            const p2f u = sampler.next2D();
+            return {(float(cell % strata) + u.x) / strata, (float(cell / strata) + u.y) / strata};
+        }
+
+        sampler.dimension = 2;
+        uint32_t x = sampleIndex, y = 0;
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+        x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+        x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+        x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+        for (uint32_t v = 1u << 31, i = sampleIndex; i; i >>= 1, v ^= v >> 1) {
+            if (i & 1) y ^= v;
+        }
+        const float px = float(x >> 8) * (1.f / 16777216.f) + shift.x;
+        const float py = float(y >> 8) * (1.f / 16777216.f) + shift.y;
+        return {px < 1.f ? px : px - 1.f, py < 1.f ? py : py - 1.f};
+    }
+
+    /**
+     * Normalized directions of the rays through film positions (x + jitter[k].x, y + jitter[k].y), k < n <= MaxBatch.
+     * Components are processed as separate arrays so that the loops vectorize.
+     */
+    void generateDirections(int x, int y, const p2f* jitter, int n, v3f* dirs) const {
+        float rx[MaxBatch], ry[MaxBatch], rz[MaxBatch];
+        for (int k = 0; k < n; k++) {
+            const float fx = float(x) + jitter[k].x;
+            const float fy = float(y) + jitter[k].y;
+            rx[k] = corner.x + fx * dx.x + fy * dy.x;
+            ry[k] = corner.y + fx * dx.y + fy * dy.y;
+            rz[k] = corner.z + fx * dx.z + fy * dy.z;
+        }
+        for (int k = 0; k < n; k++) {
+            const float invLength = 1.f / std::sqrt(rx[k] * rx[k] + ry[k] * ry[k] + rz[k] * rz[k]);
+            rx[k] *= invLength;
+            ry[k] *= invLength;
+            rz[k] *= invLength;
+        }
+        for (int k = 0; k < n; k++) {
+            dirs[k] = v3f(rx[k], ry[k], rz[k]);
+        }
+    }
+};
+
+/**
+ * Named camera view of a multi-view render.
+ */
+struct CameraView {
+    std::string name;
+    Camera camera;
+};
+
 /**
  * Configuration structure to render a scene.
  * Stores integrator, camera setup, image plane dimensions, sample count, etc.
@@ -197,6 +492,64 @@ struct Config {
     Camera camera;
     fs::path objFile, tomlFile;
     int width, height, spp;
+    EPixelJitter jitter = ERandomJitter;    // Distribution of the camera samples over a pixel
+    struct progressive_s {
+        bool enabled = false;      // Render 1 spp passes until spp or the time limit is reached
+        float timeLimit = 0.f;     // Wall-clock budget in seconds (0 = unlimited)
+        float saveInterval = 0.f;  // Seconds between intermediate EXRs (0 = only at the end)
+        int previewStride = 0;     // Spacing of the first sparse preview grid, halved down to 2 (0 = no preview)
+    } progressive;
+    struct adaptive_s {
+        bool enabled = false;      // Distribute spp * pixels samples according to per-pixel noise
+        float threshold = 0.01f;   // Target relative standard error of a pixel
+        int minSpp = 8;            // Uniform samples taken by every pixel first
+        int maxSpp = 0;            // Per-pixel cap (0 = 8 * spp)
+    } adaptive;
+    struct crop_s {
+        bool enabled = false;      // Only trace the pixels [x0, x1) x [y0, y1) of the film
+        int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        bool splice = false;       // Write the crop into the existing full-frame EXR instead of a cropped EXR
+    } crop;
+    struct animation_s {
+        int frames = 0;                         // Number of frames to render (0 = still image)
+        std::vector<CameraKeyframe> keyframes;  // Sorted by frame, at least one if frames > 0
+
+        // Camera at a frame, linearly interpolated between the surrounding keyframes
+        Camera getCamera(int frame) const {
+            auto next = std::upper_bound(keyframes.begin(), keyframes.end(), float(frame),
+                                         [](float f, const CameraKeyframe& k) { return f < k.frame; });
+            if (next == keyframes.begin()) return keyframes.front().camera;
+            if (next == keyframes.end()) return keyframes.back().camera;
+            const CameraKeyframe& a = *(next - 1);
+            const CameraKeyframe& b = *next;
+            const float t = (frame - a.frame) / (b.frame - a.frame);
+            Camera camera;
+            camera.o = glm::mix(a.camera.o, b.camera.o, t);
+            camera.at = glm::mix(a.camera.at, b.camera.at, t);
+            camera.up = glm::normalize(glm::mix(a.camera.up, b.camera.up, t));
+            camera.fov = glm::mix(a.camera.fov, b.camera.fov, t);
+            return camera;
+        }
+    } animation;
+    struct views_s {
+        std::vector<CameraView> list;   // Views rendered from one scene load (empty = the camera only)
+        fs::path packFile;              // Cubemap the faces are packed into, side by side (empty = not packed)
+    } views;
+    struct checkpoint_s {
+        float interval = 0.f;      // Seconds between checkpoints of the off-line render (0 = disabled)
+        bool resume = false;       // Continue from the checkpoint left by an interrupted render
+    } checkpoint;
+    struct tiling_s {
+        int size = 32;                          // Tile width and height in pixels
+        ETileOrder order = EHilbertTileOrder;   // Traversal order of the tiles
+    } tiling;
+    struct bvh_s {
+        EBVHBuilder builder = ESAHBVHBuilder;
+        int bins = 16;                  // Centroid bins per axis (SAH only)
+        float traversalCost = 1.f;      // SAH cost of visiting an inner node
+        float leafCost = 1.f;           // SAH cost of intersecting one primitive of a leaf
+        int width = 0;                  // Children per traversed node: 2, 4 or 8 (0 = widest the CPU supports)
+    } bvh;
     union IntegratorConfig {
         IntegratorConfig() : di{}{};
         ~IntegratorConfig() {}
@@ -308,6 +661,8 @@ struct BSDF {
         return combinedType;
     }
     virtual std::string toString() const = 0;
+    // Bytes held by the textures of the BSDF
+    virtual size_t getMemoryUsage() const { return 0; }
 };
 
 /**
@@ -339,18 +694,34 @@ struct WorldData {
 struct AcceleratorBVH;
 
 /**
- * Scene structure.
+ * Scene data structure.
  * Stores all objects, BVH, list of emitters, list of BSDFs, etc.
+ * Only depends on the OBJ file, so scenes rendering the same OBJ file can share it.
  */
-struct Scene {
-    const Config& config;
+struct SceneData {
     WorldData worldData;
     std::unique_ptr<AcceleratorBVH> bvh;
     std::vector<Emitter> emitters;
     std::vector<std::unique_ptr<BSDF>> bsdfs;
     AABB aabb;
+    bool loaded = false;
+    std::mutex loadMutex;
+};
 
-    explicit Scene(const Config& config);
+/**
+ * Scene structure.
+ * Pairs a configuration with its (possibly shared) scene data.
+ */
+struct Scene {
+    const Config& config;
+    std::shared_ptr<SceneData> data;
+    WorldData& worldData;
+    std::unique_ptr<AcceleratorBVH>& bvh;
+    std::vector<Emitter>& emitters;
+    std::vector<std::unique_ptr<BSDF>>& bsdfs;
+    AABB& aabb;
+
+    explicit Scene(const Config& config, std::shared_ptr<SceneData> data = nullptr);
     bool load(bool isRealTime);
     float getShapeArea(size_t shapeID, Distribution1D& faceAreaDistribution);
     float getShapeRadius(const size_t shapeID) const;
@@ -401,6 +772,8 @@ struct Texture {
     virtual T getAverage() const = 0;
     virtual T getMin() const = 0;
     virtual T getMax() const = 0;
+    // Bytes of texel data (none for constant textures)
+    virtual size_t getMemoryUsage() const { return 0; }
 };
 
 /**
@@ -412,6 +785,8 @@ struct Tex {
     int h;
     std::vector<float> cs;
 
+    size_t getMemoryUsage() const { return sizeof(Tex) + cs.capacity() * sizeof(float); }
+
     void pink() {
         w = 1;
         h = 1;
@@ -534,6 +909,8 @@ struct BitmapTexture3f : Texture<v3f> {
         texturePtr->load(fullpath.make_preferred().string());
     }
 
+    size_t getMemoryUsage() const override { return texturePtr->getMemoryUsage(); }
+
     v3f getAverage() const override {
         v3f s(0);
         for (size_t i = 0; i < texturePtr->cs.size() / 3; i++) {
@@ -588,6 +965,8 @@ struct BitmapTexture1f : Texture<float> {
         texturePtr->load(filename);
     }
 
+    size_t getMemoryUsage() const override { return texturePtr->getMemoryUsage(); }
+
     float getAverage() const override {
         float s(0);
         for (size_t i = 0; i < texturePtr->cs.size(); i++) {
@@ -647,57 +1026,4 @@ inline std::string toString(const v3f v) {
 
 typedef std::function<v3f(const Ray&, Sampler&)> renderer_t;
 
-class ThreadPool {
-public:
-
-    template<typename Index, typename Callable>
-    static void ParallelFor(Index start, Index end, Callable func) {
-        // Estimate number of threads in the pool
-        const static unsigned nb_threads_hint = std::thread::hardware_concurrency();
-        const static unsigned nb_threads = (nb_threads_hint == 0u ? 8u : nb_threads_hint);
-        cout << nb_threads; //4
-
-        // Size of a slice for the range functions
-        Index n = end - start + 1;
-        Index slice = (Index) std::round(n / static_cast<double> (nb_threads));
-        slice = std::max(slice, Index(1));
-
-        // [Helper] Inner loop
-        auto launchRange = [&func] (int k1, int k2) {
-            for (Index k = k1; k < k2; k++) {
-                func(k);
-            }
-        };
-
-        // Create pool and launch jobs
-        std::vector<std::thread> pool;
-        pool.reserve(nb_threads);
-        Index i1 = start;
-        Index i2 = std::min(start + slice, end);
-        for (unsigned i = 0; i + 1 < nb_threads && i1 < end; ++i) {
-            pool.emplace_back(launchRange, i1, i2);
-            i1 = i2;
-            i2 = std::min(i2 + slice, end);
-        }
-        if (i1 < end) {
-            pool.emplace_back(launchRange, i1, end);
-        }
-
-        // Wait for jobs to finish
-        for (std::thread &t : pool) {
-            if (t.joinable()) {
-                t.join();
-            }
-        }
-    }
-
-    // Serial version for easy comparison
-    template<typename Index, typename Callable>
-    static void SequentialFor(Index start, Index end, Callable func) {
-        for (Index i = start; i < end; i++) {
-            func(i);
-        }
-    }
-};
-
 TR_NAMESPACE_END
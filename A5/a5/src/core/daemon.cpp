@@ -0,0 +1,348 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/daemon.h>
+#include <core/jobs.h>
+#include <core/memory.h>
+#include <core/net.h>
+#include <core/renderer.h>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+TR_NAMESPACE_BEGIN
+
+// Largest film width or height accepted from a render daemon
+static const int MaxFilmSize = 1 << 14;
+
+/**
+ * Render job received by the daemon, along with the connection to stream its tiles to.
+ */
+struct DaemonJob {
+    std::shared_ptr<Socket> client;
+    std::unique_ptr<Config> config;
+};
+
+/**
+ * Jobs waiting to be rendered, in arrival order, until the daemon shuts down.
+ */
+struct DaemonQueue {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<DaemonJob> jobs;
+    bool closed = false;
+
+    // Fails once the queue is closed
+    bool push(DaemonJob job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return false;
+            jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    // Waits for a job, fails once the queue is closed
+    bool pop(DaemonJob& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return !jobs.empty() || closed; });
+        if (closed) return false;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+    // Rejects new jobs, wakes up the render thread and returns the jobs not started
+    std::deque<DaemonJob> close() {
+        std::deque<DaemonJob> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            pending.swap(jobs);
+        }
+        ready.notify_all();
+        return pending;
+    }
+};
+
+bool sendTile(Socket& socket, const Tile& tile, const RenderBuffer& rgb) {
+    const int32_t rect[5] = {tile.index, tile.x0, tile.y0, tile.x1, tile.y1};
+    const size_t rowSize = sizeof(v3f) * size_t(tile.x1 - tile.x0);
+    std::vector<char> message(sizeof(rect) + rowSize * size_t(tile.y1 - tile.y0));
+    std::memcpy(message.data(), rect, sizeof(rect));
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        std::memcpy(&message[sizeof(rect) + rowSize * size_t(y - tile.y0)], &rgb.data[y * rgb.width + tile.x0], rowSize);
+    }
+    return socket.send(EMsgTile, message.data(), message.size());
+}
+
+int receiveTile(const std::vector<char>& payload, v3f* rgb, int width, int height) {
+    int32_t rect[5];
+    if (payload.size() < sizeof(rect)) return -1;
+    std::memcpy(rect, payload.data(), sizeof(rect));
+    const size_t rowSize = sizeof(v3f) * size_t(rect[3] - rect[1]);
+    if (rect[1] < 0 || rect[2] < 0 || rect[3] > width || rect[4] > height || rect[1] > rect[3] || rect[2] > rect[4] ||
+        payload.size() != sizeof(rect) + rowSize * size_t(rect[4] - rect[2])) {
+        return -1;
+    }
+    for (int y = rect[2]; y < rect[4]; ++y) {
+        std::memcpy(&rgb[y * width + rect[1]], &payload[sizeof(rect) + rowSize * size_t(y - rect[2])], rowSize);
+    }
+    return rect[0];
+}
+
+std::vector<char> makeJob(const std::string& inputFile) {
+    std::ifstream file(inputFile);
+    if (!file) return std::vector<char>();
+    std::stringstream text;
+    text << file.rdbuf();
+    const std::string path = fs::absolute(inputFile).string();
+    const std::string scene = text.str();
+    std::vector<char> job(path.begin(), path.end());
+    job.push_back('\0');
+    job.insert(job.end(), scene.begin(), scene.end());
+    return job;
+}
+
+bool parseJob(const std::vector<char>& payload, Config& config, std::string& error) {
+    const auto end = std::find(payload.begin(), payload.end(), '\0');
+    if (end == payload.end()) {
+        error = "Invalid job message";
+        return false;
+    }
+
+    const std::string path(payload.begin(), end);
+    try {
+        std::istringstream text(std::string(end + 1, payload.end()));
+        cpptoml::parser parser(text);
+        if (loadTOML(config, parser.parse(), path)) {
+            error = "Real-time scenes cannot be rendered off-line";
+            return false;
+        }
+    } catch (std::exception const& e) {
+        error = std::string("Cannot parse scene ") + path + ": " + e.what();
+        return false;
+    }
+    return true;
+}
+
+static void sendError(Socket& socket, const std::string& message) {
+    std::cerr << "Error: " << message << std::endl;
+    socket.send(EMsgError, message.data(), message.size());
+}
+
+/**
+ * Reads the jobs of one client and queues them. Client threads are detached, so they share the queue.
+ */
+static void serveClient(std::shared_ptr<Socket> client, std::shared_ptr<DaemonQueue> queue) {
+    uint32_t type;
+    std::vector<char> payload;
+    while (client->receive(type, payload)) {
+        if (type != EMsgJob) {
+            sendError(*client, "Invalid job message");
+            break;
+        }
+
+        std::unique_ptr<Config> config(new Config());
+        std::string error;
+        if (!parseJob(payload, *config, error)) {
+            sendError(*client, error);
+            continue;
+        }
+
+        DaemonJob job;
+        job.client = client;
+        job.config = std::move(config);
+        if (!queue->push(std::move(job))) {
+            sendError(*client, "The render daemon is shutting down");
+            break;
+        }
+    }
+}
+
+/**
+ * Renders one job on the whole thread pool, streaming tiles as they are finished.
+ * Cached scenes are evicted first if the job would not fit in the memory budget otherwise.
+ */
+static void renderJob(const DaemonJob& job, SceneCache& cache) {
+    const auto start = std::chrono::steady_clock::now();
+    const Config& config = *job.config;
+    Socket& client = *job.client;
+
+    const std::string key = SceneCache::getKey(config);
+    const size_t sceneBytes = estimateSceneMemory(config), jobBytes = estimateFramebufferMemory(config);
+    if (!MemoryBudget::fits(key, sceneBytes, jobBytes)) cache.trim(key);
+    MemoryBudget::Reservation reservation;
+    MemoryBudget::acquire(reservation, key, sceneBytes, jobBytes);
+
+    Renderer renderer(config, cache.get(config));
+    if (!renderer.init(false, true)) {
+        sendError(client, "Cannot load scene " + config.objFile.string());
+        return;
+    }
+    reservation.update(getMemoryUsage(*renderer.scene.data), getMemoryUsage(renderer));
+
+    const int32_t size[2] = {config.width, config.height};
+    client.send(EMsgBegin, size, sizeof(size));
+
+    renderer.onTileDone = [&](const Tile& tile) {
+        sendTile(client, tile, *renderer.integrator->rgb);
+    };
+    renderer.render();
+    reservation.update(getMemoryUsage(*renderer.scene.data), getMemoryUsage(renderer));
+
+    const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    client.send(EMsgDone, &seconds, sizeof(seconds));
+    std::cout << "Job " << config.tomlFile.string() << " (" << config.width << "x" << config.height << ", "
+              << config.spp << " spp) rendered in " << seconds << "s, " << reservation.toString() << std::endl;
+}
+
+bool runDaemon(const std::string& socketPath, const std::vector<std::string>& preload) {
+    SceneCache cache;
+    std::shared_ptr<DaemonQueue> queue(new DaemonQueue());
+
+    // Load scenes up front, they are kept until the memory budget needs room for other scenes
+    for (const std::string& file : preload) {
+        Config config;
+        try {
+            loadTOML(config, file);
+        } catch (std::exception const& e) {
+            std::cerr << "Error while parsing scene file " << file << ": " << e.what() << std::endl;
+            continue;
+        }
+        // Preloaded scenes stay charged to the memory budget until evicted
+        MemoryBudget::Reservation reservation;
+        MemoryBudget::acquire(reservation, SceneCache::getKey(config), estimateSceneMemory(config), 0);
+        Scene scene(config, cache.get(config));
+        if (scene.load(false)) reservation.update(getMemoryUsage(*scene.data), 0);
+    }
+
+    std::unique_ptr<Socket> server = Socket::listen(socketPath);
+    if (!server->isValid()) return false;
+    std::cout << "Daemon listening on " << socketPath << std::endl;
+
+    // Jobs are rendered one at a time, each one using every thread of the pool
+    std::thread renderThread([&]() {
+        DaemonJob job;
+        while (queue->pop(job)) {
+            try {
+                renderJob(job, cache);
+            } catch (std::exception const& e) {
+                sendError(*job.client, e.what());
+            }
+            job = DaemonJob();
+        }
+    });
+
+    // Accept clients until SIGINT/SIGTERM (polled, since accept() is restarted after signals).
+    // Failures such as running out of file descriptors are retried with a growing delay.
+    bool ok = true;
+    int delayMs = 0;
+    while (!CancelToken::process().isCancelled()) {
+        if (!server->waitReadable(500)) continue;
+        std::shared_ptr<Socket> client(server->accept().release());
+        if (client->isValid()) {
+            delayMs = 0;
+            std::thread(serveClient, client, queue).detach();
+            continue;
+        }
+        const int error = errno;
+        if (error == EINTR || error == EAGAIN || error == ECONNABORTED) continue;
+        if (error == EBADF || error == EINVAL || error == ENOTSOCK || error == EOPNOTSUPP) {
+            std::cerr << "Error: cannot accept connections: " << std::strerror(error) << std::endl;
+            ok = false;
+            break;
+        }
+        delayMs = std::min(1000, std::max(10, 2 * delayMs));
+        std::cerr << "Error: cannot accept a connection: " << std::strerror(error) << ", retrying in " << delayMs
+                  << " ms" << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    }
+
+    // The job being rendered stops at its next pass (process token), queued ones are dropped
+    std::cout << "Daemon shutting down" << std::endl;
+    CancelToken::process().cancel();
+    for (DaemonJob& job : queue->close()) sendError(*job.client, "The render daemon is shutting down");
+    renderThread.join();
+    return ok;
+}
+
+bool submitJob(const std::string& socketPath, const std::string& inputFile, const std::string& outputFile) {
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const std::vector<char> job = makeJob(inputFile);
+    Config config;
+    std::string error;
+    if (job.empty() || !parseJob(job, config, error)) {
+        std::cerr << "Error: cannot read " << inputFile << " " << error << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<Socket> socket = Socket::connect(socketPath);
+    if (!socket->isValid() || !socket->send(EMsgJob, job.data(), job.size())) {
+        std::cerr << "Error: cannot reach render daemon on " << socketPath << std::endl;
+        return false;
+    }
+
+    int width = 0, height = 0, nbTiles = 0;
+    std::unique_ptr<v3f[]> rgb;
+    uint32_t type;
+    std::vector<char> payload;
+    while (socket->receive(type, payload)) {
+        if (type == EMsgBegin) {
+            int32_t size[2];
+            if (payload.size() != sizeof(size)) break;
+            std::memcpy(size, payload.data(), sizeof(size));
+            if (size[0] <= 0 || size[1] <= 0 || size[0] > MaxFilmSize || size[1] > MaxFilmSize) {
+                std::cerr << "Error: invalid image size " << size[0] << "x" << size[1] << " from render daemon"
+                          << std::endl;
+                return false;
+            }
+            width = size[0];
+            height = size[1];
+            rgb = std::unique_ptr<v3f[]>(new v3f[size_t(width) * height]);
+        }
+        else if (type == EMsgTile && rgb) {
+            receiveTile(payload, rgb.get(), width, height);
+            if (nbTiles++ == 0) std::cout << "First tile after " << 1000.f * elapsed() << "ms" << std::endl;
+        }
+        else if (type == EMsgDone) {
+            float seconds;
+            if (payload.size() != sizeof(seconds) || !rgb) break;
+            std::memcpy(&seconds, payload.data(), sizeof(seconds));
+            std::cout << nbTiles << " tiles received in " << elapsed() << "s (render " << seconds << "s)" << std::endl;
+
+            // The image is the size the daemon rendered, the crop window has to fit in it
+            const Config::crop_s& crop = config.crop;
+            if (crop.enabled && (crop.x1 > width || crop.y1 > height)) {
+                std::cerr << "Error: crop window outside the " << width << "x" << height << " image rendered"
+                          << std::endl;
+                return false;
+            }
+            fs::path out = outputFile.empty() ? fs::path(inputFile).replace_extension("exr") : fs::path(outputFile);
+            return Integrator::saveImage(width, height, crop, rgb, out);
+        }
+        else if (type == EMsgError) {
+            std::cerr << "Render daemon error: " << std::string(payload.begin(), payload.end()) << std::endl;
+            return false;
+        }
+    }
+
+    std::cerr << "Error: connection to render daemon lost or invalid message received" << std::endl;
+    return false;
+}
+
+TR_NAMESPACE_END
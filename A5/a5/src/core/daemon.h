@@ -0,0 +1,56 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+
+TR_NAMESPACE_BEGIN
+
+struct Socket;
+struct Tile;
+
+/**
+ * Packs a scene file into a job message (EMsgJob).
+ * Returns an empty message if the file cannot be read.
+ */
+std::vector<char> makeJob(const std::string& inputFile);
+
+/**
+ * Reads the configuration of a job message. Only off-line scenes are accepted.
+ */
+bool parseJob(const std::vector<char>& payload, Config& config, std::string& error);
+
+/**
+ * Streams the pixels of a tile of an image (EMsgTile message).
+ */
+bool sendTile(Socket& socket, const Tile& tile, const RenderBuffer& rgb);
+
+/**
+ * Copies a streamed tile into an image. Returns the tile index, or -1 if the message is malformed.
+ */
+int receiveTile(const std::vector<char>& payload, v3f* rgb, int width, int height);
+
+/**
+ * Resident render daemon.
+ * Listens on a Unix-domain socket for render jobs (TOML scenes, see EMessage) and renders them
+ * one at a time, streaming every finished tile back to the client. Scenes stay loaded between jobs,
+ * so only the first job on a given OBJ file pays for loading it and building its BVH. Idle scenes are
+ * evicted when a job would not fit in the MemoryBudget otherwise.
+ * The scene files given in preload are loaded before accepting connections.
+ * Runs until SIGINT or SIGTERM: the job being rendered is cut short and queued jobs get an error.
+ */
+bool runDaemon(const std::string& socketPath, const std::vector<std::string>& preload);
+
+/**
+ * Sends a scene to a render daemon, collects the streamed tiles and saves them as an EXR image
+ * (next to the scene file if outputFile is empty).
+ */
+bool submitJob(const std::string& socketPath, const std::string& inputFile, const std::string& outputFile);
+
+TR_NAMESPACE_END
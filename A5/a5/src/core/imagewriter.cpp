@@ -0,0 +1,86 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/imagewriter.h>
+#include <core/integrator.h>
+
+TR_NAMESPACE_BEGIN
+
+ImageWriter& ImageWriter::instance() {
+    static ImageWriter writer;
+    return writer;
+}
+
+/**
+ * Pending images are still written at exit.
+ */
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void ImageWriter::submit(const Config& config, const RenderBuffer& rgb, const fs::path& filename) {
+    ImageWriter& writer = instance();
+    const int nbPixels = rgb.width * rgb.height;
+    {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        if (!writer.thread.joinable()) writer.thread = std::thread(&ImageWriter::run, &writer);
+
+        // Reuse the queued snapshot of the same file, if any
+        Job* job = nullptr;
+        for (Job& queued : writer.jobs) {
+            if (queued.filename == filename) job = &queued;
+        }
+        if (!job) {
+            writer.jobs.push_back(Job{rgb.width, rgb.height, config.crop, filename,
+                                      std::unique_ptr<v3f[]>(new v3f[nbPixels])});
+            job = &writer.jobs.back();
+        }
+        // A job of another resolution (same output, other scene) gets a buffer of the new size
+        if (job->width != rgb.width || job->height != rgb.height) {
+            job->width = rgb.width;
+            job->height = rgb.height;
+            job->rgb = std::unique_ptr<v3f[]>(new v3f[nbPixels]);
+        }
+        job->crop = config.crop;
+        std::copy(rgb.data.get(), rgb.data.get() + nbPixels, job->rgb.get());
+    }
+    writer.wakeUp.notify_one();
+}
+
+bool ImageWriter::flush() {
+    ImageWriter& writer = instance();
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    writer.idle.wait(lock, [&]() { return writer.jobs.empty() && !writer.busy; });
+    const bool ok = !writer.failed;
+    writer.failed = false;
+    return ok;
+}
+
+void ImageWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeUp.wait(lock, [&]() { return stop || !jobs.empty(); });
+        if (jobs.empty()) return; // Stopping with nothing left to write
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        busy = true;
+        lock.unlock();
+        const bool ok = Integrator::saveImage(job.width, job.height, job.crop, job.rgb, job.filename);
+        lock.lock();
+        busy = false;
+        failed |= !ok;
+        if (jobs.empty()) idle.notify_all();
+    }
+}
+
+TR_NAMESPACE_END
@@ -0,0 +1,57 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Asynchronous EXR writer.
+ * A background thread encodes and writes images while rendering goes on: submit() only copies the
+ * render buffer into a snapshot and returns. Images are written in submission order.
+ * A snapshot still waiting for a file is overwritten by the next one for the same file, so
+ * intermediate saves never pile up: at most one image per file is queued besides the one being written.
+ */
+struct ImageWriter {
+    struct Job {
+        int width, height;
+        Config::crop_s crop;
+        fs::path filename;
+        std::unique_ptr<v3f[]> rgb;
+    };
+
+    /**
+     * Queues a copy of rgb to be saved to filename (see Integrator::saveImage).
+     */
+    static void submit(const Config& config, const RenderBuffer& rgb, const fs::path& filename);
+
+    /**
+     * Waits until every queued image is written.
+     * Returns false if any write failed since the last call.
+     */
+    static bool flush();
+
+    ~ImageWriter();
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeUp, idle;
+    std::deque<Job> jobs;
+    bool busy = false, stop = false, failed = false;
+
+    static ImageWriter& instance();
+    void run();
+};
+
+TR_NAMESPACE_END
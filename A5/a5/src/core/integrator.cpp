@@ -6,6 +6,7 @@
 */
 
 #include <core/integrator.h>
+#include <core/imagewriter.h>
 
 #include "tiny_obj_loader.h"
 
@@ -16,6 +17,7 @@ Integrator::Integrator(const Scene& scene) : scene(scene) { }
 bool Integrator::init() {
     rgb = std::unique_ptr<RenderBuffer>(new RenderBuffer(scene.config.width, scene.config.height));
     rgb->clear();
+    splats = std::unique_ptr<SplatBuffer>(new SplatBuffer(scene.config.width, scene.config.height));
     return true;
 }
 
@@ -23,10 +25,82 @@ void Integrator::cleanUp() {
     save();
 }
 
-bool Integrator::save() {
+/**
+ * Queues the RGB buffer to be saved next to the scene file by the background writer.
+ * The buffer can be modified as soon as this returns.
+ */
+void Integrator::save() {
     fs::path p = scene.config.tomlFile;
-    saveEXR(rgb->data, p.replace_extension("exr").string(), scene.config.width, scene.config.height);
-    return true;
+    ImageWriter::submit(scene.config, *rgb, p.replace_extension("exr"));
+}
+
+/**
+ * Saves a full-frame image to filename, honoring the crop window of the configuration:
+ * the cropped pixels are either written alone to filename_crop.exr or spliced into the full-frame
+ * EXR at filename (started black if there is none yet).
+ */
+bool Integrator::saveImage(const Config& config, const std::unique_ptr<v3f[]>& rgb, fs::path filename) {
+    return saveImage(config.width, config.height, config.crop, rgb, filename);
+}
+
+bool Integrator::saveImage(int filmWidth, int filmHeight, const Config::crop_s& crop,
+                           const std::unique_ptr<v3f[]>& rgb, fs::path filename) {
+    if (!crop.enabled) {
+        return saveEXR(rgb, filename.string(), filmWidth, filmHeight);
+    }
+
+    if (crop.splice && !fs::exists(filename)) {
+        // First crop of the frame: start a full-frame image, black outside the crop
+        std::cout << "No image to splice into at " << filename.string() << ", starting a new one" << std::endl;
+        std::unique_ptr<v3f[]> full(new v3f[filmWidth * filmHeight]);
+        std::fill(full.get(), full.get() + filmWidth * filmHeight, v3f(0.f));
+        for (int y = crop.y0; y < crop.y1; y++) {
+            for (int x = crop.x0; x < crop.x1; x++) {
+                full[y * filmWidth + x] = rgb[y * filmWidth + x];
+            }
+        }
+        return saveEXR(full, filename.string(), filmWidth, filmHeight);
+    }
+
+    if (crop.splice) {
+        float* rgba = nullptr;
+        int width, height;
+        const char* err = nullptr;
+        if (LoadEXR(&rgba, &width, &height, filename.string().c_str(), &err) != TINYEXR_SUCCESS) {
+            // LoadEXR does not always set an error message (e.g. unreadable files)
+            std::cout << "Cannot splice into " << filename.string() << " (" << (err ? err : "cannot read file")
+                      << "), saving the crop alone" << std::endl;
+            if (err) FreeEXRErrorMessage(err);
+        } else if (width != filmWidth || height != filmHeight) {
+            std::cout << "Cannot splice into " << filename.string() << " (" << width << "x" << height
+                      << " image), saving the crop alone" << std::endl;
+            free(rgba);
+        } else {
+            std::unique_ptr<v3f[]> full(new v3f[width * height]);
+            for (int i = 0; i < width * height; i++) {
+                full[i] = v3f(rgba[4 * i], rgba[4 * i + 1], rgba[4 * i + 2]);
+            }
+            free(rgba);
+            for (int y = crop.y0; y < crop.y1; y++) {
+                for (int x = crop.x0; x < crop.x1; x++) {
+                    full[y * width + x] = rgb[y * width + x];
+                }
+            }
+            return saveEXR(full, filename.string(), width, height);
+        }
+    }
+
+    const int width = crop.x1 - crop.x0, height = crop.y1 - crop.y0;
+    std::unique_ptr<v3f[]> cropped(new v3f[width * height]);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            cropped[y * width + x] = rgb[(crop.y0 + y) * filmWidth + crop.x0 + x];
+        }
+    }
+    fs::path croppedFile = filename;
+    croppedFile.replace_extension();
+    croppedFile += "_crop.exr";
+    return saveEXR(cropped, croppedFile.string(), width, height);
 }
 
 const Emitter& Integrator::getEmitterByID(const int emitterID) const {
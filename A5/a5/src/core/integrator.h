@@ -23,12 +23,16 @@ struct Integrator {
     const Scene& scene;
     std::vector<Sampler> samplers;
     std::unique_ptr<RenderBuffer> rgb;
+    std::unique_ptr<SplatBuffer> splats;    // Radiance splatted to arbitrary pixels by light paths
 
     explicit Integrator(const Scene& scene);
     virtual bool init();
     virtual void cleanUp();
     virtual v3f render(const Ray&, Sampler&) const = 0;
-    bool save();
+    void save();
+    static bool saveImage(const Config& config, const std::unique_ptr<v3f[]>& rgb, fs::path filename);
+    static bool saveImage(int filmWidth, int filmHeight, const Config::crop_s& crop,
+                          const std::unique_ptr<v3f[]>& rgb, fs::path filename);
 
     /**
      * Helper functions for emitter getters.
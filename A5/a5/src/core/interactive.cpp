@@ -0,0 +1,278 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/interactive.h>
+#include <core/jobs.h>
+#include <core/net.h>
+#include <core/renderer.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <signal.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * State shared between the render loop and the thread reading camera updates.
+ * The reader only touches this state, so that it can outlive the render loop (see runInteractive).
+ */
+struct PreviewInput {
+    std::mutex mutex;
+    std::condition_variable changed;
+    Camera camera;
+    bool updated = false;
+    bool closed = false;                    // Viewer gone: stop right away
+    bool finished = false;                  // No more camera updates: stop once converged
+    std::atomic<bool> interrupted{false};   // The frame being rendered is obsolete
+
+    // Also interrupts the frame being rendered, whose samples belong to the old camera
+    void setCamera(const Camera& c) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            camera = c;
+            updated = true;
+            interrupted = true;
+        }
+        changed.notify_all();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            interrupted = true;
+        }
+        changed.notify_all();
+    }
+
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        changed.notify_all();
+    }
+};
+
+/**
+ * Applies a text camera update ("eye x y z at x y z up x y z fov f", any subset) to a camera.
+ */
+static bool parseCamera(const std::string& line, Camera& camera) {
+    std::istringstream in(line);
+    std::string key;
+    bool any = false;
+    while (in >> key) {
+        v3f* v = key == "eye" ? &camera.o : key == "at" ? &camera.at : key == "up" ? &camera.up : nullptr;
+        if (v) {
+            if (!(in >> v->x >> v->y >> v->z)) return false;
+        } else if (key == "fov") {
+            if (!(in >> camera.fov)) return false;
+        } else {
+            return false;
+        }
+        any = true;
+    }
+    return any;
+}
+
+/**
+ * Sets up the path tracer, the only complete off-line integrator, for the preview.
+ * Real-time scenes get path lengths matching their renderpass: the gi settings for gi, direct lighting
+ * only for direct, and one indirect bounce for the others. Off-line scenes keep their path tracer
+ * settings, or get the default ones if they use another integrator.
+ */
+static void usePathTracer(Config& config, bool isRealTime) {
+    Config::IntegratorConfig::pt_s pt;
+    pt.isExplicit = true;
+    pt.maxDepth = -1;
+    pt.rrDepth = 5;
+    pt.rrProb = 0.95f;
+    if (isRealTime) {
+        if (config.renderpass == EGIRenderPass) {
+            pt.maxDepth = config.integratorSettings.gi.maxDepth;
+            pt.rrDepth = config.integratorSettings.gi.rrDepth;
+            pt.rrProb = config.integratorSettings.gi.rrProb;
+        } else {
+            // Short paths: no Russian roulette
+            pt.maxDepth = config.renderpass == EDirectRenderPass ? 1 : 2;
+            pt.rrDepth = pt.maxDepth + 1;
+            pt.rrProb = 1.f;
+        }
+        config.spp = 256;
+    } else if (config.integrator == EPathTracerIntegrator) {
+        return;
+    } else {
+        std::cerr << "Previewing with the path tracer instead of the integrator of the scene" << std::endl;
+    }
+    config.integrator = EPathTracerIntegrator;
+    config.integratorSettings.pt = pt;
+}
+
+/**
+ * Renders frames until the input is closed (or finished and the image converged) or the process is
+ * cancelled, restarting the accumulation on camera updates. Every finished frame is handed to emit,
+ * which returns false once the viewer is gone.
+ */
+static void previewLoop(Renderer& renderer, Config& config, PreviewInput& input,
+                        const std::function<bool(const RenderBuffer&, int)>& emit) {
+    typedef std::chrono::steady_clock Clock;
+    renderer.setupOffline();
+    int pass = 0, frame = 0;
+    Clock::time_point start = Clock::now();
+
+    while (!CancelToken::process().isCancelled()) {
+        {
+            std::unique_lock<std::mutex> lock(input.mutex);
+            // Converged: nothing to do until the camera moves (woken up regularly to notice cancellation)
+            if (!input.changed.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+                return input.updated || input.closed || input.finished || pass < config.spp;
+            })) continue;
+            if (input.closed) break;
+            if (input.updated) {
+                config.camera = input.camera;
+                input.updated = false;
+                input.interrupted = false;
+                renderer.setupOffline();
+                pass = 0;
+                start = Clock::now();
+            } else if (pass >= config.spp) {
+                break; // Finished and converged
+            }
+        }
+
+        ThreadPool::ParallelFor(0, int(renderer.tiles.size()), [&](int i) {
+            if (input.interrupted || renderer.isCancelled()) return;
+            Sampler sampler = TinyRender::Sampler(260665795);
+            renderer.renderTile(renderer.tiles[i], sampler, pass + 1);
+        }, 1);
+        if (input.interrupted || renderer.isCancelled()) continue; // Camera moved: the partial pass is dropped
+
+        pass++;
+        renderer.resolve();
+        if (!emit(*renderer.integrator->rgb, frame++)) break;
+        const float seconds = std::chrono::duration<float>(Clock::now() - start).count();
+        std::cerr << "\rPreview: " << pass << " spp, " << pass / seconds << " fps" << std::flush;
+    }
+    std::cerr << std::endl;
+}
+
+bool runInteractive(const std::string& inputFile, int scale, const std::string& format, const std::string& socketPath) {
+    const bool exr = format == "exr";
+    if (!exr && format != "ppm") {
+        std::cerr << "Error: invalid preview format " << format << " (ppm or exr)" << std::endl;
+        return false;
+    }
+
+    // Frames go to stdout, so does nothing else
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    if (socketPath.empty()) std::cout.rdbuf(std::cerr.rdbuf());
+    struct RestoreCout {
+        std::streambuf* buffer;
+        ~RestoreCout() { std::cout.rdbuf(buffer); }
+    } restoreCout{coutBuffer};
+
+    Config config;
+    try {
+        usePathTracer(config, loadTOML(config, inputFile));
+    } catch (std::exception const& e) {
+        std::cerr << "Error while parsing scene file: " << e.what() << std::endl;
+        return false;
+    }
+    config.width = std::max(1, config.width / std::max(1, scale));
+    config.height = std::max(1, config.height / std::max(1, scale));
+    config.crop.enabled = false;
+
+    Renderer renderer(config);
+    if (!renderer.init(false, true)) return false;
+
+    auto encode = [&](const RenderBuffer& rgb, std::vector<unsigned char>& image) {
+        if (exr) return encodeEXR(rgb.data.get(), rgb.width, rgb.height, image);
+        encodePPM(rgb.data.get(), rgb.width, rgb.height, image);
+        return true;
+    };
+
+    if (socketPath.empty()) {
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#else
+        signal(SIGPIPE, SIG_IGN); // A closed viewer shows up as a failed write
+#endif
+        // The reader cannot be joined while blocked on stdin, so it shares the input state instead of
+        // referring to this frame. End of input stops the preview once the image converged.
+        std::shared_ptr<PreviewInput> input(new PreviewInput());
+        input->camera = config.camera;
+        std::thread reader([input]() {
+            Camera camera = input->camera;
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                if (parseCamera(line, camera)) {
+                    input->setCamera(camera);
+                } else {
+                    std::cerr << "\nIgnoring camera update: " << line << std::endl;
+                }
+            }
+            input->finish();
+        });
+        reader.detach();
+
+        previewLoop(renderer, config, *input, [&](const RenderBuffer& rgb, int) {
+            std::vector<unsigned char> image;
+            if (!encode(rgb, image)) return false;
+            return std::fwrite(image.data(), 1, image.size(), stdout) == image.size() && std::fflush(stdout) == 0;
+        });
+        return true;
+    }
+
+    std::unique_ptr<Socket> server = Socket::listen(socketPath);
+    if (!server->isValid()) return false;
+    std::cerr << "Interactive preview listening on " << socketPath << std::endl;
+
+    // One viewer at a time, each one starting from the scene camera
+    const Camera sceneCamera = config.camera;
+    while (!CancelToken::process().isCancelled()) {
+        std::shared_ptr<Socket> viewer(server->accept().release());
+        if (!viewer->isValid()) continue;
+
+        PreviewInput input;
+        config.camera = sceneCamera;
+        std::thread reader([&]() {
+            uint32_t type;
+            std::vector<char> payload;
+            float c[10];
+            while (viewer->receive(type, payload)) {
+                if (type != EMsgCamera || payload.size() != sizeof(c)) continue;
+                std::memcpy(c, payload.data(), sizeof(c));
+                input.setCamera(Camera{v3f(c[0], c[1], c[2]), v3f(c[3], c[4], c[5]), v3f(c[6], c[7], c[8]), c[9]});
+            }
+            input.close();
+        });
+
+        previewLoop(renderer, config, input, [&](const RenderBuffer& rgb, int frame) {
+            std::vector<unsigned char> message(sizeof(int32_t));
+            const int32_t number = frame;
+            std::memcpy(message.data(), &number, sizeof(number));
+            std::vector<unsigned char> image;
+            if (!encode(rgb, image)) return false;
+            message.insert(message.end(), image.begin(), image.end());
+            return viewer->send(EMsgFrame, message.data(), message.size());
+        });
+        viewer->shutdown();
+        reader.join();
+    }
+    return true;
+}
+
+TR_NAMESPACE_END
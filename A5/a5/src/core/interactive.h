@@ -0,0 +1,28 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Headless interactive preview (no GPU needed).
+ * Renders the scene with the path tracer (path lengths of real-time scenes follow their renderpass)
+ * at 1/scale of the film resolution, one sample per pixel and per frame up to spp, and streams
+ * every frame as a PPM or EXR image (format "ppm" or "exr").
+ * Without socketPath, frames are concatenated on stdout and camera updates are read from stdin, one
+ * per line: any of "eye x y z", "at x y z", "up x y z" and "fov f". The preview ends once stdin is
+ * closed and the image has converged.
+ * With socketPath, a viewer connects to it, receives EMsgFrame messages and sends EMsgCamera ones.
+ * A camera update restarts the accumulation.
+ */
+bool runInteractive(const std::string& inputFile, int scale, const std::string& format, const std::string& socketPath);
+
+TR_NAMESPACE_END
@@ -0,0 +1,554 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/jobs.h>
+#include <core/imagewriter.h>
+#include <core/memory.h>
+#include <core/renderer.h>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Reads the [views] table of a scene: an explicit [[views.camera]] list (missing settings are taken from
+ * [camera]), a stereo pair around the camera, or the six faces of a cubemap centered on the camera eye.
+ */
+static void loadViews(Config& config, const cpptoml::table& views) {
+    const auto type = views.get_as<std::string>("type").value_or("cameras");
+    const Camera& c = config.camera;
+    std::vector<CameraView>& list = config.views.list;
+
+    if (type == "cameras") {
+        const auto cameras = views.get_table_array("camera");
+        if (!cameras) throw std::runtime_error("Views of type cameras need a [[views.camera]] list");
+        for (const auto& view : *cameras) {
+            CameraView v;
+            v.name = view->get_as<std::string>("name").value_or(std::to_string(list.size()));
+            v.camera = c;
+            v.camera.fov = view->get_as<double>("fov").value_or(c.fov);
+            if (auto e = view->get_array_of<double>("eye")) v.camera.o = v3f((*e)[0], (*e)[1], (*e)[2]);
+            if (auto e = view->get_array_of<double>("at")) v.camera.at = v3f((*e)[0], (*e)[1], (*e)[2]);
+            if (auto e = view->get_array_of<double>("up")) v.camera.up = v3f((*e)[0], (*e)[1], (*e)[2]);
+            list.push_back(v);
+        }
+    }
+    else if (type == "stereo") {
+        // Parallel pair: eye and target are both shifted along the camera right axis
+        const float separation = float(views.get_as<double>("separation").value_or(0.065));
+        const v3f offset = glm::normalize(glm::cross(c.at - c.o, c.up)) * (separation / 2.f);
+        list.push_back(CameraView{"left", Camera{c.o - offset, c.at - offset, c.up, c.fov}});
+        list.push_back(CameraView{"right", Camera{c.o + offset, c.at + offset, c.up, c.fov}});
+    }
+    else if (type == "cubemap") {
+        if (config.width != config.height) throw std::runtime_error("Cubemap faces need a square film");
+        const char* names[6] = {"px", "nx", "py", "ny", "pz", "nz"};
+        const v3f dirs[6] = {v3f(1, 0, 0), v3f(-1, 0, 0), v3f(0, 1, 0), v3f(0, -1, 0), v3f(0, 0, 1), v3f(0, 0, -1)};
+        const v3f ups[6] = {v3f(0, 1, 0), v3f(0, 1, 0), v3f(0, 0, -1), v3f(0, 0, 1), v3f(0, 1, 0), v3f(0, 1, 0)};
+        for (int f = 0; f < 6; f++) {
+            list.push_back(CameraView{names[f], Camera{c.o, c.o + dirs[f], ups[f], 90.f}});
+        }
+        if (views.get_as<bool>("pack").value_or(true)) {
+            const fs::path path(config.tomlFile);
+            config.views.packFile = path.parent_path() / path.stem();
+            config.views.packFile += "_cubemap.exr";
+        }
+    }
+    else {
+        throw std::runtime_error("Invalid views type");
+    }
+    if (list.empty()) throw std::runtime_error("No view to render");
+}
+
+/**
+ * Packs the faces of a cubemap side by side (in view order) into one EXR image.
+ */
+static bool packCubemap(const std::vector<fs::path>& faces, const fs::path& packFile) {
+    std::unique_ptr<v3f[]> packed;
+    int faceSize = 0;
+    for (size_t f = 0; f < faces.size(); f++) {
+        float* rgba = nullptr;
+        int width, height;
+        const char* err = nullptr;
+        if (LoadEXR(&rgba, &width, &height, faces[f].string().c_str(), &err) != TINYEXR_SUCCESS) {
+            std::cout << "Cannot pack " << faces[f].string() << " into a cubemap (" << err << ")" << std::endl;
+            FreeEXRErrorMessage(err);
+            return false;
+        }
+        if (!packed) {
+            faceSize = width;
+            packed = std::unique_ptr<v3f[]>(new v3f[faces.size() * faceSize * faceSize]);
+        }
+        if (width != faceSize || height != faceSize) {
+            std::cout << "Cannot pack " << faces[f].string() << " into a cubemap (" << width << "x" << height
+                      << " face)" << std::endl;
+            free(rgba);
+            return false;
+        }
+        for (int y = 0; y < faceSize; y++) {
+            for (int x = 0; x < faceSize; x++) {
+                const int i = y * faceSize + x;
+                packed[y * faces.size() * faceSize + f * faceSize + x] = v3f(rgba[4 * i], rgba[4 * i + 1], rgba[4 * i + 2]);
+            }
+        }
+        free(rgba);
+    }
+    return saveEXR(packed, packFile.string(), int(faces.size()) * faceSize, faceSize);
+}
+
+/**
+ * Load TOML scene file and create scene objects.
+ */
+bool loadTOML(Config& config, const std::string& inputFile) {
+    return loadTOML(config, cpptoml::parse_file(inputFile), inputFile);
+}
+
+bool loadTOML(Config& config, const std::shared_ptr<cpptoml::table>& data, const std::string& inputFile) {
+    // Scene and Wavefront OBJ files
+    config.tomlFile = inputFile;
+    const auto input = data->get_table("input");
+    config.objFile = *input->get_as<std::string>("objfile");
+
+    // Camera settings
+    const auto camera = data->get_table("camera");
+    config.camera.fov = camera->get_as<double>("fov").value_or(30.);
+    auto eye = camera->get_array_of<double>("eye").value_or({1., 1., 0.});
+    config.camera.o = v3f(eye[0], eye[1], eye[2]);
+    auto at = camera->get_array_of<double>("at").value_or({0., 0., 0.});
+    config.camera.at = v3f(at[0], at[1], at[2]);
+    auto up = camera->get_array_of<double>("up").value_or({0., 1., 0.});
+    config.camera.up = v3f(up[0], up[1], up[2]);
+
+    // Film settings
+    const auto film = data->get_table("film");
+    config.width = film->get_as<int>("width").value_or(768);
+    config.height = film->get_as<int>("height").value_or(576);
+    auto crop = film->get_array_of<int64_t>("crop");
+    if (crop) {
+        if (crop->size() != 4) throw std::runtime_error("Crop window must be [x0, y0, x1, y1]");
+        setCropWindow(config, int((*crop)[0]), int((*crop)[1]), int((*crop)[2]), int((*crop)[3]));
+    }
+    config.crop.splice = film->get_as<bool>("splice").value_or(false);
+
+    // Camera animation
+    const auto animation = data->get_table("animation");
+    if (animation) {
+        config.animation.frames = animation->get_as<int>("frames").value_or(0);
+        const auto keyframes = animation->get_table_array("keyframes");
+        if (keyframes) {
+            for (const auto& key : *keyframes) {
+                CameraKeyframe k;
+                k.frame = float(key->get_as<double>("frame").value_or(-1.));
+                k.camera = config.camera;
+                k.camera.fov = key->get_as<double>("fov").value_or(config.camera.fov);
+                if (auto v = key->get_array_of<double>("eye")) k.camera.o = v3f((*v)[0], (*v)[1], (*v)[2]);
+                if (auto v = key->get_array_of<double>("at")) k.camera.at = v3f((*v)[0], (*v)[1], (*v)[2]);
+                if (auto v = key->get_array_of<double>("up")) k.camera.up = v3f((*v)[0], (*v)[1], (*v)[2]);
+                config.animation.keyframes.push_back(k);
+            }
+        }
+        if (config.animation.keyframes.empty()) {
+            config.animation.keyframes.push_back(CameraKeyframe{0.f, config.camera});
+        }
+
+        // Keyframes without a frame number are spread evenly over the animation
+        const size_t nbKeys = config.animation.keyframes.size();
+        for (size_t i = 0; i < nbKeys; i++) {
+            CameraKeyframe& k = config.animation.keyframes[i];
+            if (k.frame < 0.f) k.frame = nbKeys > 1 ? float(i) * (config.animation.frames - 1) / (nbKeys - 1) : 0.f;
+        }
+        std::stable_sort(config.animation.keyframes.begin(), config.animation.keyframes.end(),
+                         [](const CameraKeyframe& a, const CameraKeyframe& b) { return a.frame < b.frame; });
+    }
+
+    // Camera views
+    const auto views = data->get_table("views");
+    if (views) {
+        loadViews(config, *views);
+    }
+
+    // Acceleration structure settings
+    const auto bvh = data->get_table("bvh");
+    if (bvh) {
+        const auto builder = bvh->get_as<std::string>("builder").value_or("sah");
+        if (builder == "sah") {
+            config.bvh.builder = ESAHBVHBuilder;
+        }
+        else if (builder == "midpoint") {
+            config.bvh.builder = EMidpointBVHBuilder;
+        }
+        else {
+            throw std::runtime_error("Invalid BVH builder");
+        }
+        config.bvh.bins = std::max(2, bvh->get_as<int>("bins").value_or(16));
+        config.bvh.traversalCost = float(bvh->get_as<double>("traversalCost").value_or(1.));
+        config.bvh.leafCost = float(bvh->get_as<double>("leafCost").value_or(1.));
+        config.bvh.width = bvh->get_as<int>("width").value_or(0);
+        if (config.bvh.width != 0 && config.bvh.width != 2 && config.bvh.width != 4 && config.bvh.width != 8) {
+            throw std::runtime_error("Invalid BVH width");
+        }
+    }
+
+    // Renderer settings
+    const auto renderer = data->get_table("renderer");
+    auto realTime = renderer->get_as<bool>("realtime").value_or(false);
+    auto type = renderer->get_as<std::string>("type").value_or("normal");
+
+    // Real-time renderpass
+    if (realTime) {
+        if (type == "normal") {
+            config.renderpass = ENormalRenderPass;
+        }
+        else if (type == "direct") {
+            config.renderpass = EDirectRenderPass;
+        }
+        else if (type == "ssao") {
+            config.renderpass = ESSAORenderPass;
+        }
+        else if (type == "gi") {
+            config.renderpass = EGIRenderPass;
+            config.integratorSettings.gi.maxDepth = renderer->get_as<int>("maxDepth").value_or(5);
+            config.integratorSettings.gi.rrDepth = renderer->get_as<int>("rrDepth").value_or(5);
+            config.integratorSettings.gi.rrProb = renderer->get_as<double>("rrProb").value_or(9.95f);
+            config.integratorSettings.gi.samplesByVertex = renderer->get_as<int>("samplesByVertex").value_or(100);
+        }
+        else {
+            throw std::runtime_error("Invalid renderpass type");
+        }
+    }
+
+    // Offline integrator
+    else {
+        if (type == "normal") {
+            config.integrator = ENormalIntegrator;
+        }
+        else if (type == "simple") {
+            config.integrator = ESimpleIntegrator;
+        }
+        else if (type == "ao") {
+            config.integrator = EAOIntegrator;
+        }
+        else if (type == "ro") {
+            config.integrator = EROIntegrator;
+            config.integratorSettings.ro.exponent = renderer->get_as<double>("exponent").value_or(30);
+        }
+        else if (type == "direct") {
+            config.integrator = EDirectIntegrator;
+            config.integratorSettings.di.emitterSamples = renderer->get_as<size_t>("emitterSamples").value_or(1);
+            config.integratorSettings.di.bsdfSamples = renderer->get_as<size_t>("bsdfSamples").value_or(1);
+            config.integratorSettings.di.samplingStrategy = renderer->get_as<string>("samplingStrategy").value_or("emitter");
+        }
+        else if (type == "path") {
+            config.integrator = EPathTracerIntegrator;
+            config.integratorSettings.pt.isExplicit = renderer->get_as<bool>("isExplicit").value_or(true);
+            config.integratorSettings.pt.maxDepth = renderer->get_as<int>("maxDepth").value_or(-1);
+            config.integratorSettings.pt.rrDepth = renderer->get_as<int>("rrDepth").value_or(5);
+            config.integratorSettings.pt.rrProb = renderer->get_as<double>("rrProb").value_or(0.95f);
+        }
+        else {
+            throw std::runtime_error("Invalid integrator type");
+        }
+
+        config.spp = renderer->get_as<int>("spp").value_or(1);
+        const auto jitter = renderer->get_as<std::string>("jitter").value_or("random");
+        if (jitter == "random") {
+            config.jitter = ERandomJitter;
+        }
+        else if (jitter == "stratified") {
+            config.jitter = EStratifiedJitter;
+        }
+        else if (jitter == "sobol") {
+            config.jitter = ESobolJitter;
+        }
+        else {
+            throw std::runtime_error("Invalid pixel jitter");
+        }
+
+        // Progressive settings
+        config.progressive.enabled = renderer->get_as<bool>("progressive").value_or(false);
+        config.progressive.timeLimit = renderer->get_as<double>("timeLimit").value_or(0.);
+        config.progressive.saveInterval = renderer->get_as<double>("saveInterval").value_or(0.);
+        config.progressive.previewStride = std::max(0, renderer->get_as<int>("previewStride").value_or(0));
+
+        // Adaptive sampling settings
+        config.adaptive.enabled = renderer->get_as<bool>("adaptive").value_or(false);
+        config.adaptive.threshold = renderer->get_as<double>("adaptiveThreshold").value_or(0.01);
+        config.adaptive.minSpp = renderer->get_as<int>("adaptiveMinSpp").value_or(8);
+        config.adaptive.maxSpp = renderer->get_as<int>("adaptiveMaxSpp").value_or(0);
+
+        // Checkpoint settings
+        config.checkpoint.interval = renderer->get_as<double>("checkpointInterval").value_or(0.);
+
+        // Tiling settings
+        config.tiling.size = std::max(1, renderer->get_as<int>("tileSize").value_or(32));
+        const auto tileOrder = renderer->get_as<std::string>("tileOrder").value_or("hilbert");
+        if (tileOrder == "scanline") {
+            config.tiling.order = EScanlineTileOrder;
+        }
+        else if (tileOrder == "morton") {
+            config.tiling.order = EMortonTileOrder;
+        }
+        else if (tileOrder == "hilbert") {
+            config.tiling.order = EHilbertTileOrder;
+        }
+        else {
+            throw std::runtime_error("Invalid tile order");
+        }
+    }
+
+    return realTime;
+}
+
+
+/**
+ * Load the off-line render jobs of a TOML scene file: one per frame for animations, one per view for
+ * multi-view scenes, one otherwise.
+ * Frame n of scene.toml is rendered as if from scene_000n.toml, hence written to scene_000n.exr, and
+ * view v as if from scene_v.toml.
+ * Returns no job for real-time scenes.
+ */
+std::vector<std::unique_ptr<Config>> loadJobs(const std::string& inputFile) {
+    std::vector<std::unique_ptr<Config>> jobs;
+    const auto data = cpptoml::parse_file(inputFile);
+    std::unique_ptr<Config> config(new Config());
+    if (loadTOML(*config, data, inputFile)) return jobs;
+
+    const fs::path path(inputFile);
+    const int nbFrames = config->animation.frames;
+    const std::vector<CameraView>& views = config->views.list;
+    if (!views.empty()) {
+        if (nbFrames > 0) throw std::runtime_error("Views cannot be animated");
+        for (const CameraView& view : views) {
+            fs::path viewPath = path.parent_path() / path.stem();
+            viewPath += "_" + view.name + ".toml";
+
+            std::unique_ptr<Config> job(new Config());
+            loadTOML(*job, data, viewPath.string());
+            job->camera = view.camera;
+            job->views.list.clear();
+            job->views.packFile = config->views.packFile;
+            jobs.push_back(std::move(job));
+        }
+        return jobs;
+    }
+    if (nbFrames <= 0) {
+        jobs.push_back(std::move(config));
+        return jobs;
+    }
+
+    for (int f = 0; f < nbFrames; f++) {
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), "_%04d.toml", f);
+        fs::path framePath = path.parent_path() / path.stem();
+        framePath += suffix;
+
+        std::unique_ptr<Config> frame(new Config());
+        loadTOML(*frame, data, framePath.string());
+        frame->camera = config->animation.getCamera(f);
+        frame->animation.frames = 0;
+        jobs.push_back(std::move(frame));
+    }
+    return jobs;
+}
+
+/**
+ * Restricts rendering to the pixels [x0, x1) x [y0, y1), clamped to the film.
+ */
+void setCropWindow(Config& config, int x0, int y0, int x1, int y1) {
+    config.crop.x0 = std::max(0, x0);
+    config.crop.y0 = std::max(0, y0);
+    config.crop.x1 = std::min(config.width, x1);
+    config.crop.y1 = std::min(config.height, y1);
+    if (config.crop.x0 >= config.crop.x1 || config.crop.y0 >= config.crop.y1) {
+        throw std::runtime_error("Crop window does not overlap the film");
+    }
+    config.crop.enabled = true;
+}
+
+/**
+ * Scene data are keyed on the absolute path of the OBJ file and on the BVH settings,
+ * since the BVH is built once with the settings of the first job loading the scene.
+ */
+std::string SceneCache::getKey(const Config& config) {
+    fs::path file(config.objFile);
+    if (!file.is_absolute())
+        file = config.tomlFile.parent_path() / file;
+    if (fs::exists(file))
+        file = fs::canonical(file);
+    const Config::bvh_s& bvh = config.bvh;
+    std::ostringstream key;
+    key << file.make_preferred().string() << " (" << (bvh.builder == ESAHBVHBuilder ? "sah" : "midpoint")
+        << " bvh, bins " << bvh.bins << ", costs " << bvh.traversalCost << "/" << bvh.leafCost
+        << ", width " << bvh.width << ")";
+    return key.str();
+}
+
+std::shared_ptr<SceneData> SceneCache::get(const Config& config) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<SceneData>& data = scenes[getKey(config)];
+    if (!data) data = std::make_shared<SceneData>();
+    return data;
+}
+
+/**
+ * Drops the cache reference to the scene data of a configuration.
+ * Data are freed once the last renderer using them is gone.
+ */
+void SceneCache::release(const Config& config) {
+    const std::string key = getKey(config);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        scenes.erase(key);
+    }
+    MemoryBudget::releaseScene(key);
+}
+
+/**
+ * Drops every cached scene but keep that no renderer is using.
+ * Returns the number of scenes dropped.
+ */
+size_t SceneCache::trim(const std::string& keep) {
+    std::vector<std::string> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = scenes.begin(); it != scenes.end();) {
+            if (it->first != keep && it->second.use_count() == 1) {
+                dropped.push_back(it->first);
+                it = scenes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (const std::string& key : dropped) {
+        std::cout << "Evicting scene " << key << " from the cache" << std::endl;
+        MemoryBudget::releaseScene(key);
+    }
+    return dropped.size();
+}
+
+bool runBatch(const std::vector<std::string>& inputs, int nbConcurrentJobs, bool resume,
+              const std::vector<int>& crop, bool splice) {
+    // Expand directories to the TOML files they contain
+    std::vector<std::string> files;
+    for (const std::string& input : inputs) {
+        if (fs::is_directory(input)) {
+            std::vector<std::string> dirFiles;
+            for (fs::directory_iterator it(input); it != fs::directory_iterator(); ++it) {
+                if (it->path().extension() == ".toml") dirFiles.push_back(it->path().string());
+            }
+            std::sort(dirFiles.begin(), dirFiles.end());
+            files.insert(files.end(), dirFiles.begin(), dirFiles.end());
+        } else {
+            files.push_back(input);
+        }
+    }
+
+    // Parse all jobs up front (files that cannot be parsed count as failed jobs)
+    std::vector<std::unique_ptr<Config>> jobs;
+    bool hasAnimation = false;
+    std::atomic<int> nbFailed(0);
+    for (const std::string& file : files) {
+        std::vector<std::unique_ptr<Config>> fileJobs;
+        try {
+            fileJobs = loadJobs(file);
+            for (auto& config : fileJobs) {
+                if (crop.size() == 4) setCropWindow(*config, crop[0], crop[1], crop[2], crop[3]);
+                if (splice) config->crop.splice = true;
+                // Cubemaps are packed from the full-frame faces, which only spliced crops update
+                if (config->crop.enabled && !config->crop.splice && !config->views.packFile.empty()) {
+                    throw std::runtime_error("cubemap faces can only be cropped with --splice");
+                }
+            }
+        } catch (std::exception const& e) {
+            std::cerr << "Error while parsing scene file " << file << ": " << e.what() << std::endl;
+            nbFailed++;
+            continue;
+        }
+        if (fileJobs.empty()) std::cout << "Skipping real-time scene " << file << std::endl;
+        hasAnimation |= fileJobs.size() > 1;
+        for (auto& config : fileJobs) {
+            config->checkpoint.resume = resume;
+            jobs.push_back(std::move(config));
+        }
+    }
+
+    // Animation frames and views are pipelined: the next one starts while the tiles of the previous one finish
+    if (nbConcurrentJobs <= 0) nbConcurrentJobs = hasAnimation ? 2 : 1;
+
+    // Group jobs by OBJ file, so that each scene can be freed as soon as its last job is done
+    std::stable_sort(jobs.begin(), jobs.end(), [](const std::unique_ptr<Config>& a, const std::unique_ptr<Config>& b) {
+        return SceneCache::getKey(*a) < SceneCache::getKey(*b);
+    });
+    std::map<std::string, int> remainingJobs;
+    for (const auto& job : jobs) remainingJobs[SceneCache::getKey(*job)]++;
+    std::cout << "Batch: " << jobs.size() << " jobs over " << remainingJobs.size() << " distinct scenes" << std::endl;
+
+    // Run jobs, up to nbConcurrentJobs at a time (each job still renders on the shared thread pool)
+    SceneCache cache;
+    std::mutex remainingMutex;
+    std::atomic<size_t> nextJob(0);
+    const auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        for (size_t j = nextJob++; j < jobs.size() && !CancelToken::process().isCancelled(); j = nextJob++) {
+            const Config& config = *jobs[j];
+            const std::string key = SceneCache::getKey(config);
+            MemoryBudget::Reservation reservation;
+            MemoryBudget::acquire(reservation, key, estimateSceneMemory(config), estimateFramebufferMemory(config));
+            const auto jobStart = std::chrono::steady_clock::now();
+            {
+                Renderer renderer(config, cache.get(config));
+                if (renderer.init(false, true)) {
+                    reservation.update(getMemoryUsage(*renderer.scene.data), getMemoryUsage(renderer));
+                    renderer.render();
+                    reservation.update(getMemoryUsage(*renderer.scene.data), getMemoryUsage(renderer));
+                    renderer.cleanUp();
+                } else {
+                    nbFailed++;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(remainingMutex);
+                if (--remainingJobs[key] == 0) cache.release(config);
+            }
+            std::cout << "Job " << config.tomlFile.string() << " done in "
+                      << std::chrono::duration<float>(std::chrono::steady_clock::now() - jobStart).count()
+                      << "s, " << reservation.toString() << std::endl;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nbConcurrentJobs; i++) threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads) t.join();
+    if (!ImageWriter::flush()) nbFailed++;
+
+    // Cubemaps are packed once all their faces are written
+    std::map<fs::path, std::vector<fs::path>> packs;
+    for (const auto& job : jobs) {
+        if (job->views.packFile.empty()) continue;
+        fs::path face = job->tomlFile;
+        packs[job->views.packFile].push_back(face.replace_extension("exr"));
+    }
+    for (const auto& pack : packs) {
+        if (!CancelToken::process().isCancelled() && !packCubemap(pack.second, pack.first)) nbFailed++;
+    }
+    if (CancelToken::process().isCancelled()) {
+        std::cout << "Batch cancelled" << std::endl;
+        return false;
+    }
+
+    std::cout << "Batch done in " << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count()
+              << "s (" << nbFailed << " failed), peak accounted memory " << formatBytes(MemoryBudget::getPeak())
+              << ", process peak RSS " << formatBytes(getPeakRSS()) << std::endl;
+    return nbFailed == 0;
+}
+
+TR_NAMESPACE_END
@@ -0,0 +1,65 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+#include <map>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Load TOML scene file and create scene objects.
+ * Returns true for real-time scenes.
+ */
+bool loadTOML(Config& config, const std::string& inputFile);
+
+/**
+ * Create scene objects from an already parsed TOML scene.
+ * Relative paths are resolved against the directory of inputFile.
+ */
+bool loadTOML(Config& config, const std::shared_ptr<cpptoml::table>& data, const std::string& inputFile);
+
+/**
+ * Load the off-line render jobs of a TOML scene file: one per frame for animations, one per view for
+ * multi-view scenes, one otherwise.
+ * Returns no job for real-time scenes.
+ */
+std::vector<std::unique_ptr<Config>> loadJobs(const std::string& inputFile);
+
+/**
+ * Restricts rendering to the pixels [x0, x1) x [y0, y1), clamped to the film.
+ */
+void setCropWindow(Config& config, int x0, int y0, int x1, int y1);
+
+/**
+ * Scene cache.
+ * Hands out one SceneData per distinct OBJ file and BVH settings, so that jobs rendering the same
+ * geometry parse it and build its BVH only once.
+ * Cached scenes are charged to the MemoryBudget until they leave the cache.
+ */
+struct SceneCache {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<SceneData>> scenes;
+
+    static std::string getKey(const Config& config);
+    std::shared_ptr<SceneData> get(const Config& config);
+    void release(const Config& config);
+    size_t trim(const std::string& keep);
+};
+
+/**
+ * Renders every TOML file given (directories are expanded to the TOML files they contain)
+ * in one process, running up to nbConcurrentJobs jobs at the same time (0 picks 1, or 2 if there are
+ * animations). Jobs are only started when they fit in the MemoryBudget.
+ * A crop window (x0, y0, x1, y1) and splice, if given, apply to every job (frame or view).
+ */
+bool runBatch(const std::vector<std::string>& inputs, int nbConcurrentJobs, bool resume,
+              const std::vector<int>& crop = std::vector<int>(), bool splice = false);
+
+TR_NAMESPACE_END
@@ -59,20 +59,52 @@ inline float getLuminance(const v3f& rgb) {
 }
 
 /**
- * Pseudo-random sampler (Mersenne Twister 19937) structure.
+ * Counter-based sampler structure.
+ * Each sample value is a hash of (seed, pixel, sample index, dimension) instead of the next state
+ * of a sequential generator, so any sample of any pixel can be regenerated on its own: the image
+ * does not depend on how pixels are split between threads, tiles or processes, nor on their order.
+ * Call startPixelSample() before drawing the values of a camera sample. Without it, the sampler
+ * behaves like a plain random stream determined by its seed.
  */
 struct Sampler {
-    std::mt19937 g;
-    std::uniform_real_distribution<float> d;
+    uint64_t seedKey;
+    uint64_t streamKey;     // Hash of the seed, pixel and sample index
+    uint32_t dimension;     // Number of values drawn since the stream started
+
     explicit Sampler(int seed) {
-        g = std::mt19937(seed);
-        d = std::uniform_real_distribution<float>(0.f, 1.f);
+        setSeed(seed);
     }
-    float next() { return d(g); }
-    p2f next2D() { return {d(g), d(g)}; }
+
     void setSeed(int seed) {
-        g.seed(seed);
-        d.reset();
+        seedKey = mix(uint64_t(uint32_t(seed)));
+        startPixelSample(0, 0);
+    }
+
+    // Restarts the stream at a given dimension (the first one by default) of a given sample of a given pixel
+    void startPixelSample(uint32_t pixel, uint32_t sampleIndex, uint32_t firstDimension = 0) {
+        streamKey = mix(seedKey ^ ((uint64_t(pixel) << 32) | sampleIndex));
+        dimension = firstDimension;
+    }
+
+    float next() {
+        // Top 24 bits, so that the value is exactly representable and stays below 1
+        const uint64_t h = mix(streamKey + 0x9e3779b97f4a7c15ull * (uint64_t(dimension++) + 1));
+        return float(h >> 40) * (1.f / 16777216.f);
+    }
+
+    p2f next2D() {
+        const float x = next();
+        return {x, next()};
+    }
+
+    // 64-bit finalizer of MurmurHash3: every input bit affects every output bit
+    static uint64_t mix(uint64_t v) {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdull;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ull;
+        v ^= v >> 33;
+        return v;
     }
 };
 
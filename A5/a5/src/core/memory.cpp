@@ -0,0 +1,229 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/memory.h>
+#include <core/accel.h>
+#include <core/renderer.h>
+#include <cstdio>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+// Parsed geometry and BVH take about this many bytes per byte of OBJ text (vector growth included)
+static const size_t SceneBytesPerObjByte = 4;
+
+template<typename T>
+static size_t getCapacity(const std::vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+size_t getMemoryUsage(const SceneData& data) {
+    const WorldData& w = data.worldData;
+    size_t bytes = sizeof(SceneData);
+    bytes += getCapacity(w.attrib.vertices) + getCapacity(w.attrib.normals) + getCapacity(w.attrib.texcoords)
+             + getCapacity(w.attrib.colors);
+    for (const tinyobj::shape_t& shape : w.shapes) {
+        const tinyobj::mesh_t& m = shape.mesh;
+        bytes += sizeof(shape) + getCapacity(m.indices) + getCapacity(m.num_face_vertices)
+                 + getCapacity(m.material_ids) + getCapacity(m.smoothing_group_ids);
+    }
+    bytes += getCapacity(w.materials) + getCapacity(w.shapesCenter) + getCapacity(w.shapesAABOX);
+
+    if (data.bvh) bytes += data.bvh->getMemoryUsage();
+    for (const Emitter& emitter : data.emitters) bytes += sizeof(emitter) + getCapacity(emitter.faceAreaDistribution.cdf);
+    for (const auto& bsdf : data.bsdfs) {
+        if (bsdf) bytes += bsdf->getMemoryUsage();
+    }
+    return bytes;
+}
+
+size_t getMemoryUsage(const Renderer& renderer) {
+    size_t bytes = getCapacity(renderer.tiles);
+    if (renderer.tileDone) bytes += renderer.tiles.size() * sizeof(std::atomic<bool>);
+    if (renderer.accum) {
+        bytes += size_t(renderer.accum->width) * renderer.accum->height
+                 * (sizeof(v3f) + sizeof(uint32_t) + 2 * sizeof(float));
+    }
+    if (renderer.integrator) {
+        const Integrator& integrator = *renderer.integrator;
+        if (integrator.rgb) bytes += size_t(integrator.rgb->width) * integrator.rgb->height * sizeof(v3f);
+        if (integrator.splats) bytes += integrator.splats->getMemoryUsage();
+    }
+    return bytes;
+}
+
+size_t estimateSceneMemory(const Config& config) {
+    fs::path file(config.objFile);
+    if (!file.is_absolute())
+        file = config.tomlFile.parent_path() / file;
+    if (!fs::exists(file)) return 0;
+    return size_t(fs::file_size(file)) * SceneBytesPerObjByte;
+}
+
+size_t estimateFramebufferMemory(const Config& config) {
+    return size_t(config.width) * config.height * (2 * sizeof(v3f) + sizeof(uint32_t) + 2 * sizeof(float));
+}
+
+size_t getPeakRSS() {
+#if defined(_WIN32)
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return size_t(usage.ru_maxrss);
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+std::string formatBytes(size_t bytes) {
+    char s[32];
+    std::snprintf(s, sizeof(s), "%.1f MB", bytes / (1024. * 1024.));
+    return s;
+}
+
+MemoryBudget& MemoryBudget::instance() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+void MemoryBudget::setLimit(size_t bytes) {
+    MemoryBudget& budget = instance();
+    {
+        std::lock_guard<std::mutex> lock(budget.mutex);
+        budget.limit = bytes;
+    }
+    budget.released.notify_all();
+}
+
+size_t MemoryBudget::getLimit() {
+    MemoryBudget& budget = instance();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.limit;
+}
+
+size_t MemoryBudget::getUsed() {
+    MemoryBudget& budget = instance();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.used;
+}
+
+size_t MemoryBudget::getPeak() {
+    MemoryBudget& budget = instance();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.peak;
+}
+
+/**
+ * Bytes a job adds to the budget: scene data are only charged for the first job using them.
+ */
+size_t MemoryBudget::getNeeded(const std::string& scene, size_t sceneBytes, size_t jobBytes) const {
+    return jobBytes + (scenes.count(scene) ? 0 : sceneBytes);
+}
+
+bool MemoryBudget::fits(const std::string& scene, size_t sceneBytes, size_t jobBytes) {
+    MemoryBudget& budget = instance();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.limit == 0 || budget.used + budget.getNeeded(scene, sceneBytes, jobBytes) <= budget.limit;
+}
+
+/**
+ * Jobs larger than the whole budget wait for every other job to finish, and hold back the jobs queued
+ * after them so that they are not starved.
+ */
+void MemoryBudget::acquire(Reservation& reservation, const std::string& scene, size_t sceneBytes, size_t jobBytes) {
+    MemoryBudget& budget = instance();
+    std::unique_lock<std::mutex> lock(budget.mutex);
+    auto hasRoom = [&]() {
+        return budget.limit == 0 || budget.used + budget.getNeeded(scene, sceneBytes, jobBytes) <= budget.limit;
+    };
+
+    if (budget.limit > 0 && budget.getNeeded(scene, sceneBytes, jobBytes) > budget.limit) {
+        std::cout << "Job on " << scene << " needs about " << formatBytes(budget.getNeeded(scene, sceneBytes, jobBytes))
+                  << ", more than the memory budget of " << formatBytes(budget.limit) << ": running it alone"
+                  << std::endl;
+        budget.nbExclusive++;
+        budget.released.wait(lock, [&]() { return budget.nbJobs == 0; });
+        budget.nbExclusive--;
+    } else if (budget.nbExclusive > 0 || !hasRoom()) {
+        std::cout << "Job on " << scene << " queued until " << formatBytes(budget.getNeeded(scene, sceneBytes, jobBytes))
+                  << " of the memory budget are free" << std::endl;
+        budget.released.wait(lock, [&]() { return budget.nbExclusive == 0 && (hasRoom() || budget.nbJobs == 0); });
+    }
+
+    auto it = budget.scenes.find(scene);
+    if (it == budget.scenes.end()) {
+        it = budget.scenes.insert(std::make_pair(scene, sceneBytes)).first;
+        budget.used += sceneBytes;
+    }
+    budget.used += jobBytes;
+    budget.peak = std::max(budget.peak, budget.used);
+    budget.nbJobs++;
+
+    reservation.scene = scene;
+    reservation.sceneBytes = it->second;
+    reservation.jobBytes = jobBytes;
+    reservation.peakBytes = it->second + jobBytes;
+    reservation.active = true;
+}
+
+void MemoryBudget::releaseScene(const std::string& scene) {
+    MemoryBudget& budget = instance();
+    {
+        std::lock_guard<std::mutex> lock(budget.mutex);
+        auto it = budget.scenes.find(scene);
+        if (it == budget.scenes.end()) return;
+        budget.used -= it->second;
+        budget.scenes.erase(it);
+    }
+    budget.released.notify_all();
+}
+
+/**
+ * Measured sizes may exceed the budget: the job is already running, later jobs wait for it instead.
+ */
+void MemoryBudget::Reservation::update(size_t sceneBytes, size_t jobBytes) {
+    if (!active) return;
+    MemoryBudget& budget = instance();
+    {
+        std::lock_guard<std::mutex> lock(budget.mutex);
+        auto it = budget.scenes.find(scene);
+        if (it != budget.scenes.end()) {
+            budget.used = budget.used - it->second + sceneBytes;
+            it->second = sceneBytes;
+        }
+        budget.used = budget.used - this->jobBytes + jobBytes;
+        budget.peak = std::max(budget.peak, budget.used);
+        this->sceneBytes = sceneBytes;
+        this->jobBytes = jobBytes;
+        peakBytes = std::max(peakBytes, sceneBytes + jobBytes);
+    }
+    budget.released.notify_all();
+}
+
+MemoryBudget::Reservation::~Reservation() {
+    if (!active) return;
+    MemoryBudget& budget = instance();
+    {
+        std::lock_guard<std::mutex> lock(budget.mutex);
+        budget.used -= jobBytes;
+        budget.nbJobs--;
+    }
+    budget.released.notify_all();
+}
+
+std::string MemoryBudget::Reservation::toString() const {
+    return "peak memory " + formatBytes(peakBytes) + " (scene " + formatBytes(sceneBytes) + ", framebuffers "
+           + formatBytes(jobBytes) + "), process peak RSS " + formatBytes(getPeakRSS());
+}
+
+TR_NAMESPACE_END
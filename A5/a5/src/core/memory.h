@@ -0,0 +1,111 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <core/core.h>
+#include <condition_variable>
+#include <map>
+
+TR_NAMESPACE_BEGIN
+
+struct Renderer;
+
+/**
+ * Bytes held by loaded scene data: geometry, BVH, emitters, BSDFs and their textures.
+ */
+size_t getMemoryUsage(const SceneData& data);
+
+/**
+ * Bytes held by the framebuffers of an off-line renderer: image, splats and sample accumulation.
+ */
+size_t getMemoryUsage(const Renderer& renderer);
+
+/**
+ * Estimate of the scene data of a job before it is loaded, from the size of its OBJ file.
+ */
+size_t estimateSceneMemory(const Config& config);
+
+/**
+ * Estimate of the framebuffers of a job before it starts (splats excluded).
+ */
+size_t estimateFramebufferMemory(const Config& config);
+
+/**
+ * Peak resident set size of the process so far, or 0 where unknown.
+ */
+size_t getPeakRSS();
+
+/**
+ * Formats a byte count in MB.
+ */
+std::string formatBytes(size_t bytes);
+
+/**
+ * Process-wide memory budget of concurrent render jobs (batch and daemon modes).
+ * Each job holds a reservation for its framebuffers; scene data are charged once per scene, whatever the
+ * number of jobs sharing them, until releaseScene() is called by their cache.
+ * A job is admitted when its reservation fits in the budget and queued otherwise. A job that cannot fit
+ * even on its own is downgraded to running alone once every other job is done.
+ * A limit of 0 disables the budget: jobs are only accounted.
+ */
+struct MemoryBudget {
+    /**
+     * Memory charged on behalf of one job, released on destruction.
+     */
+    struct Reservation {
+        std::string scene;
+        size_t sceneBytes = 0, jobBytes = 0;
+        size_t peakBytes = 0;   // Largest scene + framebuffer charge of the job
+        bool active = false;
+
+        Reservation() = default;
+        Reservation(const Reservation&) = delete;
+        ~Reservation();
+
+        // Replaces the estimates by measured sizes, once the job is loaded and as it grows
+        void update(size_t sceneBytes, size_t jobBytes);
+
+        // Peak memory of the job and of the process, for the render log
+        std::string toString() const;
+    };
+
+    static void setLimit(size_t bytes);
+    static size_t getLimit();
+
+    /**
+     * Blocks until the job fits in the budget (scene data charged only if not already),
+     * then charges it to the reservation.
+     */
+    static void acquire(Reservation& reservation, const std::string& scene, size_t sceneBytes, size_t jobBytes);
+
+    /**
+     * Returns whether a job would be admitted right away.
+     */
+    static bool fits(const std::string& scene, size_t sceneBytes, size_t jobBytes);
+
+    /**
+     * Stops charging scene data that were freed (or handed to no cache anymore).
+     */
+    static void releaseScene(const std::string& scene);
+
+    static size_t getUsed();
+    static size_t getPeak();
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    size_t limit = 0, used = 0, peak = 0;
+    int nbJobs = 0, nbExclusive = 0;
+    std::map<std::string, size_t> scenes;
+
+    static MemoryBudget& instance();
+    size_t getNeeded(const std::string& scene, size_t sceneBytes, size_t jobBytes) const;
+};
+
+TR_NAMESPACE_END
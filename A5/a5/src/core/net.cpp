@@ -0,0 +1,178 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#include <core/net.h>
+#include <cerrno>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+Socket::~Socket() {
+    close();
+}
+
+#if defined(_WIN32)
+
+void Socket::close() { fd = -1; }
+void Socket::shutdown() { }
+
+std::unique_ptr<Socket> Socket::listen(const std::string& path) {
+    std::cerr << "Error: render sockets are not supported on this platform" << std::endl;
+    return std::unique_ptr<Socket>(new Socket());
+}
+
+std::unique_ptr<Socket> Socket::connect(const std::string& path) {
+    return listen(path);
+}
+
+std::unique_ptr<Socket> Socket::accept() { return std::unique_ptr<Socket>(new Socket()); }
+bool Socket::waitReadable(int) { return false; }
+bool Socket::sendAll(const void*, size_t) { return false; }
+bool Socket::recvAll(void*, size_t) { return false; }
+
+#else
+
+void Socket::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+void Socket::shutdown() {
+    if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+}
+
+static bool makeAddress(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+/**
+ * Returns whether path is a socket file nobody listens on anymore (left by a killed process).
+ */
+static bool isStaleSocket(const std::string& path, const sockaddr_un& addr) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode)) return false;
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    const bool refused = ::connect(fd, (const sockaddr*) &addr, sizeof(addr)) < 0 && errno == ECONNREFUSED;
+    ::close(fd);
+    return refused;
+}
+
+/**
+ * Creates a listening socket, replacing a stale socket file left at path. Any other file at path
+ * (a live socket or a regular file) is kept, and listening fails.
+ */
+std::unique_ptr<Socket> Socket::listen(const std::string& path) {
+    std::unique_ptr<Socket> s(new Socket());
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) return s;
+
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0) {
+        if (!isStaleSocket(path, addr)) {
+            std::cerr << "Error: cannot listen on " << path << ": address in use" << std::endl;
+            return s;
+        }
+        ::unlink(path.c_str());
+    }
+
+    s->fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s->fd < 0) return s;
+    if (::bind(s->fd, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(s->fd, 16) < 0) {
+        std::cerr << "Error: cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        s->close();
+    }
+    return s;
+}
+
+std::unique_ptr<Socket> Socket::connect(const std::string& path) {
+    std::unique_ptr<Socket> s(new Socket());
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) return s;
+
+    s->fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s->fd >= 0 && ::connect(s->fd, (sockaddr*) &addr, sizeof(addr)) < 0) s->close();
+    return s;
+}
+
+std::unique_ptr<Socket> Socket::accept() {
+    return std::unique_ptr<Socket>(new Socket(::accept(fd, nullptr, nullptr)));
+}
+
+bool Socket::waitReadable(int timeoutMs) {
+    pollfd p = {fd, POLLIN, 0};
+    return isValid() && ::poll(&p, 1, timeoutMs) > 0;
+}
+
+bool Socket::sendAll(const void* data, size_t size) {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL; // A closed peer must not kill the process
+#else
+    const int flags = 0;
+#endif
+    const char* p = (const char*) data;
+    while (size > 0) {
+        const ssize_t n = ::send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+bool Socket::recvAll(void* data, size_t size) {
+    char* p = (char*) data;
+    while (size > 0) {
+        const ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+#endif
+
+bool Socket::send(uint32_t type, const void* payload, size_t size) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    const MessageHeader header = {type, uint32_t(size)};
+    return isValid() && size <= MaxMessageSize && sendAll(&header, sizeof(header))
+           && (size == 0 || sendAll(payload, size));
+}
+
+bool Socket::receive(uint32_t& type, std::vector<char>& payload) {
+    MessageHeader header;
+    if (!isValid() || !recvAll(&header, sizeof(header))) return false;
+    type = header.type;
+    if (header.size > MaxMessageSize) {
+        std::cerr << "Error: message of " << header.size << " bytes exceeds the limit, closing the connection"
+                  << std::endl;
+        shutdown();
+        return false;
+    }
+    payload.resize(header.size);
+    return header.size == 0 || recvAll(payload.data(), header.size);
+}
+
+TR_NAMESPACE_END
@@ -0,0 +1,71 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <mutex>
+#include <vector>
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Message types exchanged over render sockets, between a client and a daemon,
+ * between a coordinator and its workers, or between an interactive preview and its viewer.
+ * Every message is a MessageHeader followed by size bytes of payload (native byte order).
+ */
+enum EMessage : uint32_t {
+    EMsgJob = 1,    // To renderer: absolute TOML path, '\0', TOML scene text
+    EMsgBegin,      // From renderer: int32 width, height (workers add their number of threads)
+    EMsgTile,       // From renderer: int32 index, x0, y0, x1, y1, then (x1-x0)*(y1-y0) RGB floats
+    EMsgDone,       // From renderer: float render time in seconds
+    EMsgError,      // From renderer: error text
+    EMsgRenderTile, // To worker: int32 tile index
+    EMsgFrame,      // From preview: int32 frame number, then a whole PPM or EXR image file
+    EMsgCamera      // To preview: float eye[3], at[3], up[3], fov
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t size;
+};
+
+// Largest payload accepted from a peer (a preview frame or a tile of a very large film)
+static const uint32_t MaxMessageSize = 256u << 20;
+
+/**
+ * Unix-domain stream socket.
+ * Owns its file descriptor; sends are serialized so several threads can stream messages.
+ */
+struct Socket {
+    int fd = -1;
+    std::mutex sendMutex;
+
+    explicit Socket(int fd = -1) : fd(fd) { }
+    ~Socket();
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    bool isValid() const { return fd >= 0; }
+    void close();
+    void shutdown();    // Ends both directions, waking up a thread blocked in receive()
+
+    static std::unique_ptr<Socket> listen(const std::string& path);
+    static std::unique_ptr<Socket> connect(const std::string& path);
+    std::unique_ptr<Socket> accept();
+    bool waitReadable(int timeoutMs);   // False on timeout, on a signal or on error
+
+    bool send(uint32_t type, const void* payload, size_t size);
+    // Fails and closes the connection on payloads larger than MaxMessageSize
+    bool receive(uint32_t& type, std::vector<char>& payload);
+
+private:
+    bool sendAll(const void* data, size_t size);
+    bool recvAll(void* data, size_t size);
+};
+
+TR_NAMESPACE_END
@@ -55,6 +55,7 @@ inline string pp(string p) {
 
 #define deg2rad M_PI / 180.f
 #define Epsilon 1e-8f
+#define ShadowEpsilon 1e-4f // Shadow rays stop this fraction of their length short of the light
 typedef glm::fvec2 v2f;
 typedef glm::fvec3 v3f;
 typedef glm::fvec4 v4f;
@@ -9,6 +9,9 @@
 #include <core/accel.h>
 #include <core/renderer.h>
 #include <GL/glew.h>
+#include <chrono>
+#include <csignal>
+#include <fstream>
 
 #ifdef __APPLE__
 #include "SDL.h"
@@ -45,7 +48,7 @@
 
 TR_NAMESPACE_BEGIN
 
-Renderer::Renderer(const Config& config) : scene(config) { }
+Renderer::Renderer(const Config& config, std::shared_ptr<SceneData> sceneData) : scene(config, sceneData) { }
 
 bool Renderer::init(const bool isRealTime, bool nogui) {
     realTime = isRealTime;
@@ -114,66 +117,610 @@ void Renderer::render() {
         }
     } else {
         // 1.1 Off-line Rendering Loop
+        setupOffline();
+        checkpointOwned = false;
+        uint32_t progress = scene.config.checkpoint.resume ? loadCheckpoint() : 0;
+
+        if (scene.config.progressive.enabled) {
+            progress = renderProgressive(progress);
+        } else if (scene.config.adaptive.enabled) {
+            progress = renderAdaptive(progress);
+        } else {
+            // 3) Render all tiles in parallel, each one with its own sampler.
+            // Samples only depend on their pixel and index, so the image does not depend on the thread count.
+            ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+                if (isCancelled()) return;
+                if (!tileDone[i]) { // Otherwise restored from a checkpoint
+                    renderFullTile(tiles[i]);
+                    if (isCancelled()) return; // The tile may be partial, it is topped up on resume
+                    tileDone[i] = true;
+                    maybeCheckpoint(0);
+                }
+                finishTile(tiles[i]);
+            }, 1);
+        }
 
-        v3f eye = scene.config.camera.o;
-        v3f at = scene.config.camera.at;
-        v3f up = scene.config.camera.up;
-        float fov = scene.config.camera.fov;
-        float width = scene.config.width;
-        float height = scene.config.height;
+        // 4) Average the samples of each pixel
+        resolve();
+
+        if (isCancelled()) {
+            std::cout << "\nRender cancelled, saving a partial image" << std::endl;
+            // Keep the work done so far for --resume
+            if (isCheckpointing()) saveCheckpoint(progress);
+        } else if (checkpointOwned && fs::exists(getCheckpointPath())) {
+            // The render is complete, its checkpoint would only be stale from now on. Checkpoints left by
+            // other renders of the scene (e.g. a crop render after a killed full render) are kept.
+            fs::remove(getCheckpointPath());
+        }
+    }
+}
 
-        v3f pixelColor;
+bool Renderer::isCancelled() const {
+    return cancelToken.isCancelled() || CancelToken::process().isCancelled();
+}
+
+static void cancelProcess(int signal) {
+    if (CancelToken::process().isCancelled()) {
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+        return;
+    }
+    CancelToken::process().cancel();
+}
+
+void cancelOnSignals() {
+    std::signal(SIGINT, cancelProcess);
+    std::signal(SIGTERM, cancelProcess);
+}
+
+/**
+ * Sets up the camera, the buffers and the tiles of an off-line render.
+ */
+void Renderer::setupOffline() {
+    // 1) calculate camera perspectives
+    camera = PinholeCamera(scene.config.camera, scene.config.width, scene.config.height, scene.config.spp,
+                           scene.config.jitter);
+
+    // 2) Clear integral RGB buffer
+    integrator->rgb->clear();
+    integrator->splats->clear();
+    accum = std::unique_ptr<AccumulationBuffer>(new AccumulationBuffer(scene.config.width, scene.config.height));
+    const Config::crop_s& crop = scene.config.crop;
+    cropX0 = crop.enabled ? crop.x0 : 0;
+    cropY0 = crop.enabled ? crop.y0 : 0;
+    cropX1 = crop.enabled ? crop.x1 : scene.config.width;
+    cropY1 = crop.enabled ? crop.y1 : scene.config.height;
+    tiles = buildTiles(cropX0, cropY0, cropX1, cropY1, scene.config.tiling.size, scene.config.tiling.order);
+    tileDone = std::unique_ptr<std::atomic<bool>[]>(new std::atomic<bool>[tiles.size()]);
+    for (size_t i = 0; i < tiles.size(); i++) tileDone[i] = false;
+    lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+/**
+ * Progressive off-line rendering loop.
+ * Adds one sample per pixel and per pass until spp passes are done or the time limit is reached.
+ * Tiles are not started past the deadline: per-pixel sample counts keep the average unbiased.
+ * With a preview stride, sparse grids of pixels are traced first (see renderPreview); pass n then
+ * only tops up the pixels that have fewer than n samples.
+ * Returns the number of passes done.
+ */
+uint32_t Renderer::renderProgressive(uint32_t firstPass) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    Clock::time_point lastSave = start;
+    const float timeLimit = scene.config.progressive.timeLimit;
+    const float saveInterval = scene.config.progressive.saveInterval;
+    auto secondsSince = [](const Clock::time_point& t) {
+        return std::chrono::duration<float>(Clock::now() - t).count();
+    };
+
+    // Passes always cover the whole image, checkpoints are taken between them
+    for (size_t i = 0; i < tiles.size(); i++) tileDone[i] = true;
+
+    // Preview grids, coarsest first (a resumed render is already past them)
+    if (firstPass == 0) {
+        for (int stride = scene.config.progressive.previewStride; stride >= 2; stride /= 2) {
+            if ((timeLimit > 0.f && secondsSince(start) >= timeLimit) || isCancelled()) break;
+            renderPreview(stride);
+            std::cout << "\rPreview 1/" << stride << " (" << secondsSince(start) << "s)" << std::flush;
+            if (saveInterval > 0.f) {
+                integrator->save();
+                lastSave = Clock::now();
+            }
+        }
+    }
 
-        int i = 0;
-        int j;
-        // 1) calculate camera perspectives
-        glm::mat4 inverseView = glm::lookAt(eye,at,up);
-        float scaling = tan((M_PI*fov/180.f) / 2.f);
-        float aspectRatio = width/height;
+    std::atomic<bool> outOfTime(false);
+    int pass = int(firstPass);
+    while (pass < scene.config.spp && !outOfTime && !isCancelled()) {
+        ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+            if (timeLimit > 0.f && secondsSince(start) >= timeLimit) {
+                outOfTime = true;
+                return;
+            }
+            if (isCancelled()) return;
+            Sampler sampler = TinyRender::Sampler(260665795);
+            renderTile(tiles[i], sampler, pass + 1);
+            finishTile(tiles[i]);
+        }, 1);
+        if (isCancelled()) break; // Pass left unfinished, redone (topped up) on resume
+        pass++;
+
+        std::cout << "\rPass " << pass << "/" << scene.config.spp << " (" << secondsSince(start) << "s)" << std::flush;
+
+        // Intermediate snapshot, written in the background while the next passes trace
+        if (saveInterval > 0.f && secondsSince(lastSave) >= saveInterval && pass < scene.config.spp && !outOfTime) {
+            resolve();
+            integrator->save();
+            lastSave = Clock::now();
+        }
+        maybeCheckpoint(uint32_t(pass));
+    }
 
-        // 2) Clear integral RGB buffer
-        integrator->rgb->clear();
+    std::cout << "\nProgressive render: " << accum->getMinCount(cropX0, cropY0, cropX1, cropY1) << " to " << pass << " spp in "
+              << secondsSince(start) << "s" << std::endl;
+    return uint32_t(pass);
+}
 
-        // 3) Loop over all pixels on the image plane
+/**
+ * Preview pass of the progressive mode.
+ * Gives one sample to every pixel of a grid of the given stride (aligned on the crop window) that has none yet,
+ * then fills the RGB buffer by repeating each grid pixel over its stride x stride block.
+ * Only the display is upsampled: the samples are regular samples of the grid pixels, kept by the later passes.
+ */
+void Renderer::renderPreview(int stride) {
+    ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+        if (isCancelled()) return;
         Sampler sampler = TinyRender::Sampler(260665795);
-//        ThreadPool::ParallelFor(0, scene.config.height, [&](int y) {
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-
-//                if (scene.config.spp == 1) {
-//                    float px = (x - width / 2.f + 0.5f) / (width / 2.f) * scaling * aspectRatio;
-//                    float py = -((y - height / 2.f + 0.5f) / (height / 2.f) * scaling);
-//
-//                    v4f aug4D = v4f(px, py, -1.f, 0.f);
-//                    v4f dir = aug4D * inverseView;
-//                    Ray ray = Ray(eye, dir);
-//
-//                    pixelColor = integrator->render(ray, sampler);
-//                    integrator->rgb->data[y*scene.config.width + x] = pixelColor;
-////                    i++;
-//                }
-////--------------------------------------BONUS-------------------------------------------
-//                else {
-                    v3f sumColor = v3f(0.f, 0.f, 0.f);
-                    for (j = 0; j < scene.config.spp; j++) {
-                        float px = ((x - width / 2.f + sampler.next()) / (width / 2.f) * scaling * aspectRatio);
-                        float py = -((y - height / 2.f + sampler.next()) / (height / 2.f) * scaling);
-                        v4f aug4D = v4f(px, py, -1.f, 0.f);
-                        v4f dir = aug4D * inverseView;
-                        dir = glm::normalize(dir);
-                        Ray ray = Ray(eye, dir);
-
-                        pixelColor = integrator->render(ray, sampler);
-                        sumColor = sumColor + pixelColor;
-                    }
-                    integrator->rgb->data[y*scene.config.width + x] = sumColor;
-//                }
-//------------------------------------END OF BONUS--------------------------------------
+        const Tile& tile = tiles[i];
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            if ((y - cropY0) % stride != 0) continue;
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                if ((x - cropX0) % stride == 0 && accum->count[y * scene.config.width + x] == 0) {
+                    renderPixel(x, y, sampler, 1);
+                }
+            }
+        }
+    }, 1);
+
+    // Blocks can straddle tiles, so upsampling waits for the whole grid
+    ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+        upsampleTile(tiles[i], stride);
+        if (onTileDone) onTileDone(tiles[i]);
+    }, 1);
+}
+
+/**
+ * Writes the current estimate of a tile to the RGB buffer, taking pixels without samples
+ * from the top-left pixel of their block on the preview grid of the given stride.
+ */
+void Renderer::upsampleTile(const Tile& tile, int stride) {
+    const int width = scene.config.width;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        const int gy = y - (y - cropY0) % stride;
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            const int i = y * width + x;
+            const int gx = x - (x - cropX0) % stride;
+            integrator->rgb->data[i] = accum->getAverage(accum->count[i] > 0 ? i : gy * width + gx);
+        }
+    }
+}
+
+/**
+ * Accumulated samples of one pixel, as saved before an adaptive round.
+ */
+struct PixelState {
+    int i;
+    v3f sum;
+    uint32_t count;
+    float lumMean, lumM2;
+};
+
+/**
+ * Adaptive off-line rendering loop.
+ * Every pixel first gets minSpp samples, then rounds of extra samples go to the pixels whose
+ * relative error is still above the threshold, until the budget of spp samples per pixel
+ * (on average) is spent, every pixel converged, or noisy pixels hit their cap.
+ * Returns the number of rounds done.
+ */
+uint32_t Renderer::renderAdaptive(uint32_t firstRound) {
+    const Config::adaptive_s& settings = scene.config.adaptive;
+    const int nbPixels = (cropX1 - cropX0) * (cropY1 - cropY0);
+    const int minSpp = std::max(2, settings.minSpp);
+    const uint32_t maxSpp = uint32_t(settings.maxSpp > 0 ? settings.maxSpp : 8 * scene.config.spp);
+    const long long budget = (long long) scene.config.spp * nbPixels;
+
+    auto isActive = [&](int i) {
+        return accum->count[i] < maxSpp && accum->getRelativeError(i) > settings.threshold;
+    };
+    // Calls func(i) for every traced pixel, one tile at a time
+    auto forEachPixel = [&](const Tile& tile, const std::function<void(int)>& func) {
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                func(y * scene.config.width + x);
             }
         }
-        //scale the pixelColor down by 1/16 to obtain average
-        integrator->rgb->scale(1.0f/scene.config.spp);
+    };
+
+    // Rounds always cover the whole image, checkpoints are taken between them
+    for (size_t i = 0; i < tiles.size(); i++) tileDone[i] = true;
+
+    // 1) Uniform pass (round 0)
+    if (firstRound == 0) {
+        ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+            if (isCancelled()) return;
+            Sampler sampler = TinyRender::Sampler(260665795);
+            renderTile(tiles[i], sampler, minSpp);
+            finishTile(tiles[i]);
+        }, 1);
+        if (isCancelled()) return 0; // Uniform pass topped up on resume
+        maybeCheckpoint(1);
     }
+    long long used = 0;
+    for (const Tile& tile : tiles) {
+        forEachPixel(tile, [&](int i) { used += accum->count[i]; });
+    }
+
+    // 2) Refinement rounds over unconverged pixels
+    int round = std::max(1, int(firstRound));
+    while (used < budget && !isCancelled()) {
+        std::atomic<int> nbActive(0);
+        ThreadPool::ParallelFor(0, int(tiles.size()), [&](int t) {
+            int n = 0;
+            forEachPixel(tiles[t], [&](int i) { if (isActive(i)) n++; });
+            nbActive += n;
+        }, 1);
+        if (nbActive == 0 || budget - used < nbActive) break;
+
+        const int batch = int(std::min<long long>((budget - used) / nbActive, minSpp));
+        std::atomic<long long> taken(0);
+        // State of the refined pixels before the round, restored if it gets interrupted
+        std::vector<std::vector<PixelState>> before(tiles.size());
+        ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+            if (isCancelled()) return;
+            const Tile& tile = tiles[i];
+            Sampler sampler = TinyRender::Sampler(260665795);
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    const int p = y * scene.config.width + x;
+                    if (!isActive(p)) continue;
+                    const uint32_t count = accum->count[p];
+                    before[i].push_back({p, accum->sum[p], count, accum->lumMean[p], accum->lumM2[p]});
+                    renderPixel(x, y, sampler, std::min(batch, int(maxSpp - count)));
+                    taken += accum->count[p] - count;
+                }
+            }
+            finishTile(tile);
+        }, 1);
+
+        // Drop a partial round, so that the last checkpoint and a resumed render match an uninterrupted one
+        if (isCancelled()) {
+            ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+                for (const PixelState& state : before[i]) {
+                    accum->sum[state.i] = state.sum;
+                    accum->count[state.i] = state.count;
+                    accum->lumMean[state.i] = state.lumMean;
+                    accum->lumM2[state.i] = state.lumM2;
+                }
+                finishTile(tiles[i]);
+            }, 1);
+            break;
+        }
+        used += taken;
+        round++;
+        maybeCheckpoint(uint32_t(round));
+    }
+
+    // 3) Report the error actually achieved
+    int nbConverged = 0;
+    float maxError = 0.f, meanError = 0.f;
+    for (const Tile& tile : tiles) {
+        forEachPixel(tile, [&](int i) {
+            const float error = accum->getRelativeError(i);
+            if (error <= settings.threshold) nbConverged++;
+            maxError = std::max(maxError, error);
+            meanError += error / nbPixels;
+        });
+    }
+    std::cout << "Adaptive render: " << float(used) / nbPixels << " spp on average (" << round << " rounds), "
+              << 100.f * nbConverged / nbPixels << "% of pixels below threshold " << settings.threshold
+              << ", achieved relative error " << meanError << " mean / " << maxError << " max" << std::endl;
+    return uint32_t(round);
+}
+
+/**
+ * Checkpoint file header.
+ * Followed by one byte per tile in row-major order (1 if the tile is finished), then the per-pixel sums, sample counts,
+ * luminance means and luminance M2 of the accumulation buffer, in native byte order.
+ * Samples are keyed on their pixel and index, so the per-pixel sample counts and the progress counter
+ * are all the sampler state needed to resume.
+ */
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height, spp, tileSize;
+    uint32_t mode;          // 0: regular, 1: progressive, 2: adaptive
+    uint32_t progress;      // Completed passes (progressive) or rounds (adaptive)
+    uint32_t nbTiles;
+    int32_t crop[4];        // Traced pixels x0, y0, x1, y1
+};
+
+fs::path Renderer::getCheckpointPath() const {
+    fs::path p = scene.config.tomlFile;
+    return p.replace_extension("ckpt");
+}
+
+uint32_t Renderer::getRenderMode() const {
+    if (scene.config.progressive.enabled) return 1;
+    if (scene.config.adaptive.enabled) return 2;
+    return 0;
+}
+
+/**
+ * Whether this render saves checkpoints: periodically, or at least when cancelled if it was resumed.
+ */
+bool Renderer::isCheckpointing() const {
+    return scene.config.checkpoint.interval > 0.f || scene.config.checkpoint.resume;
+}
+
+/**
+ * Saves a checkpoint if the checkpoint interval elapsed and no other thread is already saving one.
+ */
+void Renderer::maybeCheckpoint(uint32_t progress) {
+    if (scene.config.checkpoint.interval <= 0.f) return;
+    std::unique_lock<std::mutex> lock(checkpointMutex, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<float>(now - lastCheckpoint).count() < scene.config.checkpoint.interval) return;
+    saveCheckpoint(progress);
+    lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+/**
+ * Writes the finished tiles of the accumulation buffer to the checkpoint file.
+ * Unfinished tiles may be rendered concurrently, so their pixels are stored as empty.
+ * The file is written next to its final location and renamed, so a kill never leaves a torn checkpoint.
+ */
+void Renderer::saveCheckpoint(uint32_t progress) {
+    const int nbPixels = scene.config.width * scene.config.height;
+    CheckpointHeader header = {{'T', 'R', 'C', 'K'}, 2u,
+                               uint32_t(scene.config.width), uint32_t(scene.config.height),
+                               uint32_t(scene.config.spp), uint32_t(scene.config.tiling.size),
+                               getRenderMode(), progress, uint32_t(tiles.size()),
+                               {cropX0, cropY0, cropX1, cropY1}};
+
+    std::vector<uint8_t> done(tiles.size());
+    std::vector<v3f> sum(nbPixels, v3f(0.f));
+    std::vector<uint32_t> count(nbPixels, 0);
+    std::vector<float> lumMean(nbPixels, 0.f), lumM2(nbPixels, 0.f);
+    for (size_t t = 0; t < tiles.size(); t++) {
+        done[tiles[t].index] = tileDone[t] ? 1 : 0;
+        if (!tileDone[t]) continue;
+        for (int y = tiles[t].y0; y < tiles[t].y1; y++) {
+            for (int x = tiles[t].x0; x < tiles[t].x1; x++) {
+                const int i = y * scene.config.width + x;
+                sum[i] = accum->sum[i];
+                count[i] = accum->count[i];
+                lumMean[i] = accum->lumMean[i];
+                lumM2[i] = accum->lumM2[i];
+            }
+        }
+    }
+
+    const fs::path path = getCheckpointPath();
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+    std::ofstream out(tmpPath.string(), std::ios::binary);
+    out.write((const char*) &header, sizeof(header));
+    out.write((const char*) done.data(), done.size());
+    out.write((const char*) sum.data(), sizeof(v3f) * nbPixels);
+    out.write((const char*) count.data(), sizeof(uint32_t) * nbPixels);
+    out.write((const char*) lumMean.data(), sizeof(float) * nbPixels);
+    out.write((const char*) lumM2.data(), sizeof(float) * nbPixels);
+    out.close();
+    if (!out) {
+        std::cout << "\nFailed to write checkpoint " << tmpPath << std::endl;
+        return;
+    }
+    fs::rename(tmpPath, path);
+    checkpointOwned = true;
+    std::cout << "\nSaved checkpoint to " << path.string() << std::endl;
+}
+
+/**
+ * Restores the accumulation buffer and finished tiles from the checkpoint file, if any.
+ * Returns the progress counter (passes or rounds) to resume from.
+ */
+uint32_t Renderer::loadCheckpoint() {
+    const fs::path path = getCheckpointPath();
+    std::ifstream in(path.string(), std::ios::binary);
+    if (!in) {
+        std::cout << "No checkpoint found at " << path.string() << ", starting from scratch" << std::endl;
+        return 0;
+    }
+
+    const int nbPixels = scene.config.width * scene.config.height;
+    CheckpointHeader header;
+    in.read((char*) &header, sizeof(header));
+    const int32_t crop[4] = {cropX0, cropY0, cropX1, cropY1};
+    if (!in || std::string(header.magic, 4) != "TRCK" || header.version != 2u
+        || header.width != uint32_t(scene.config.width) || header.height != uint32_t(scene.config.height)
+        || header.spp != uint32_t(scene.config.spp) || header.tileSize != uint32_t(scene.config.tiling.size)
+        || header.mode != getRenderMode() || header.nbTiles != uint32_t(tiles.size())
+        || !std::equal(crop, crop + 4, header.crop)) {
+        throw std::runtime_error("Checkpoint " + path.string() + " does not match the scene settings");
+    }
+
+    std::vector<uint8_t> done(tiles.size());
+    in.read((char*) done.data(), done.size());
+    in.read((char*) accum->sum.get(), sizeof(v3f) * nbPixels);
+    in.read((char*) accum->count.get(), sizeof(uint32_t) * nbPixels);
+    in.read((char*) accum->lumMean.get(), sizeof(float) * nbPixels);
+    in.read((char*) accum->lumM2.get(), sizeof(float) * nbPixels);
+    if (!in) {
+        throw std::runtime_error("Checkpoint " + path.string() + " is truncated");
+    }
+    for (size_t t = 0; t < tiles.size(); t++) tileDone[t] = done[tiles[t].index] != 0;
+    checkpointOwned = true;
+
+    std::cout << "Resumed from checkpoint " << path.string() << " (progress " << header.progress << ")" << std::endl;
+    return header.progress;
+}
+
+/**
+ * Position of tile (x, y) along the Morton (Z-order) curve: the bits of x and y interleaved.
+ */
+static uint32_t mortonIndex(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+/**
+ * Position of tile (x, y) along the Hilbert curve covering a n x n grid (n a power of two).
+ */
+static uint32_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y) {
+    uint32_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        const uint32_t rx = (x & s) ? 1 : 0;
+        const uint32_t ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so the curve stays continuous
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/**
+ * Splits the pixels [x0, x1) x [y0, y1) of the image plane into square tiles
+ * (smaller on the right and bottom borders), listed in the given traversal order.
+ * Parallel loops hand contiguous ranges of tiles to each thread, so along a space-filling
+ * curve every thread works on a compact region of the image.
+ */
+std::vector<Tile> Renderer::buildTiles(int x0, int y0, int x1, int y1, int tileSize, ETileOrder order) {
+    std::vector<Tile> tiles;
+    std::vector<uint32_t> keys;
+    const int nx = (x1 - x0 + tileSize - 1) / tileSize;
+    const int ny = (y1 - y0 + tileSize - 1) / tileSize;
+    uint32_t n = 1;
+    while (n < uint32_t(std::max(nx, ny))) n *= 2;
+
+    for (int ty = 0; ty < ny; ty++) {
+        for (int tx = 0; tx < nx; tx++) {
+            Tile tile;
+            tile.index = int(tiles.size());
+            tile.x0 = x0 + tx * tileSize;
+            tile.y0 = y0 + ty * tileSize;
+            tile.x1 = std::min(tile.x0 + tileSize, x1);
+            tile.y1 = std::min(tile.y0 + tileSize, y1);
+            tiles.push_back(tile);
+            keys.push_back(order == EMortonTileOrder ? mortonIndex(uint32_t(tx), uint32_t(ty))
+                         : order == EHilbertTileOrder ? hilbertIndex(n, uint32_t(tx), uint32_t(ty))
+                         : uint32_t(tile.index));
+        }
+    }
+
+    std::sort(tiles.begin(), tiles.end(), [&keys](const Tile& a, const Tile& b) {
+        return keys[a.index] < keys[b.index];
+    });
+    return tiles;
+}
+
+/**
+ * Renders all the samples of a tile in one go (only the missing ones for a tile left partial by a cancelled render).
+ * Samples only depend on their pixel and index, so the image does not depend on which thread
+ * (or process) renders which tile, nor on how the film is tiled or cropped.
+ */
+void Renderer::renderFullTile(const Tile& tile) {
+    Sampler sampler = TinyRender::Sampler(260665795);
+    renderTile(tile, sampler, scene.config.spp);
+}
+
+/**
+ * Accumulates samples into the accumulation buffer until every pixel of a tile has spp of them.
+ */
+void Renderer::renderTile(const Tile& tile, Sampler& sampler, int spp) {
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            const int count = int(accum->count[y * scene.config.width + x]);
+            if (count < spp) renderPixel(x, y, sampler, spp - count);
+        }
+    }
+}
+
+/**
+ * Traces spp more camera rays jittered over a pixel footprint and accumulates their radiance.
+ * Sample streams are numbered after the samples the pixel already has, so rendering a pixel in
+ * several calls gives the same samples as rendering it in one.
+ * Primary rays are generated in batches of PinholeCamera::MaxBatch.
+ */
+void Renderer::renderPixel(int x, int y, Sampler& sampler, int spp) {
+    const int i = y * scene.config.width + x;
+    const uint32_t firstSample = accum->count[i];
+    p2f jitter[PinholeCamera::MaxBatch];
+    v3f dirs[PinholeCamera::MaxBatch];
+
+    for (int j0 = 0; j0 < spp; j0 += PinholeCamera::MaxBatch) {
+        const int n = std::min(PinholeCamera::MaxBatch, spp - j0);
+        for (int k = 0; k < n; k++) {
+            jitter[k] = camera.sampleJitter(sampler, uint32_t(i), firstSample + uint32_t(j0 + k));
+        }
+        camera.generateDirections(x, y, jitter, n, dirs);
+
+        for (int k = 0; k < n; k++) {
+            if (isCancelled()) return;
+            // The integrator continues the stream of the sample after the jitter dimensions
+            sampler.startPixelSample(uint32_t(i), firstSample + uint32_t(j0 + k), 2);
+            accum->addSample(i, integrator->render(Ray(camera.eye, dirs[k]), sampler));
+        }
+    }
+}
+
+/**
+ * Writes the current estimate of the image to the integrator RGB buffer: per-pixel averages of the
+ * camera samples, plus the splatted radiance normalized as one light path per camera sample.
+ */
+void Renderer::resolve() {
+    accum->resolve(*integrator->rgb);
+    if (integrator->splats->isEmpty()) return;
+
+    long long nbSamples = 0;
+    for (const Tile& tile : tiles) {
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                nbSamples += accum->count[y * scene.config.width + x];
+            }
+        }
+    }
+    const long long nbPixels = (long long) (cropX1 - cropX0) * (cropY1 - cropY0);
+    if (nbSamples > 0) integrator->splats->merge(*integrator->rgb, float(nbPixels) / float(nbSamples));
+}
+
+/**
+ * Resolves the current estimate of a tile and hands it to the tile callback, if any.
+ */
+void Renderer::finishTile(const Tile& tile) {
+    if (!onTileDone) return;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            const int i = y * scene.config.width + x;
+            integrator->rgb->data[i] = accum->getAverage(i);
+        }
+    }
+    onTileDone(tile);
 }
 
 /**
@@ -191,9 +738,23 @@ BSDF::BSDF(const WorldData& d, const Config& c, const size_t matID) : worldData(
     emission = glm::make_vec3(worldData.materials[matID].emission);
 }
 
-Scene::Scene(const Config& config) : config(config) { }
+Scene::Scene(const Config& config, std::shared_ptr<SceneData> sharedData)
+    : config(config),
+      data(sharedData ? sharedData : std::make_shared<SceneData>()),
+      worldData(data->worldData),
+      bvh(data->bvh),
+      emitters(data->emitters),
+      bsdfs(data->bsdfs),
+      aabb(data->aabb) { }
 
+/**
+ * Loads the OBJ file and builds BSDFs, emitters and BVH.
+ * Does nothing if the (shared) scene data was already loaded.
+ */
 bool Scene::load(bool isRealTime) {
+    std::lock_guard<std::mutex> lock(data->loadMutex);
+    if (data->loaded) return true;
+
     fs::path file(config.objFile);
     bool ret = false;
     std::string err;
@@ -263,10 +824,14 @@ bool Scene::load(bool isRealTime) {
     // Build BVH
     bvh = std::unique_ptr<TinyRender::AcceleratorBVH>(new TinyRender::AcceleratorBVH(this->worldData));
 
-    const clock_t beginBVH = clock();
-    bvh->build();
-    std::cout << "BVH built in " << float(clock() - beginBVH) / CLOCKS_PER_SEC << "s" << std::endl;
+    const auto beginBVH = std::chrono::steady_clock::now();
+    bvh->build(config.bvh);
+    std::cout << "BVH built in " << std::chrono::duration<float>(std::chrono::steady_clock::now() - beginBVH).count()
+              << "s ("
+              << (config.bvh.builder == ESAHBVHBuilder ? "SAH" : "midpoint") << ", " << bvh->bvh->getNodeCount()
+              << " nodes, SAH cost " << bvh->bvh->getSAHCost() << ", " << bvh->getWidth() << "-wide)" << std::endl;
 
+    data->loaded = true;
     return true;
 }
 
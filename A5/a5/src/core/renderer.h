@@ -11,9 +11,43 @@
 #include <core/core.h>
 #include <core/integrator.h>
 #include <core/renderpass.h>
+#include <chrono>
 
 TR_NAMESPACE_BEGIN
 
+/**
+ * Rectangular block of pixels rendered as one unit of work.
+ * Covers pixels [x0, x1) x [y0, y1) of the image plane.
+ * The index is the row-major position of the tile in the tile grid, whatever the traversal order.
+ */
+struct Tile {
+    int index;
+    int x0, y0, x1, y1;
+};
+
+/**
+ * Cooperative cancellation flag of off-line renders.
+ * Render loops check it between tiles and between samples, and stop with a partial but correctly
+ * normalized image (each pixel averages the samples it got).
+ * The process-wide token is set by SIGINT/SIGTERM once cancelOnSignals() has been called.
+ */
+struct CancelToken {
+    std::atomic<bool> cancelled{false};
+
+    void cancel() { cancelled = true; }
+    bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    static CancelToken& process() {
+        static CancelToken token;
+        return token;
+    }
+};
+
+/**
+ * Cancels the process-wide token on the first SIGINT or SIGTERM. A second signal kills the process.
+ */
+void cancelOnSignals();
+
 /**
  * Renderer structure (offline and real-time).
  */
@@ -27,10 +61,50 @@ struct Renderer {
     unsigned int previousTime = 0, currentTime = 0;
     const int frameDuration = 30;
 
-    explicit Renderer(const Config& config);
+    // Off-line tiling
+    std::vector<Tile> tiles;                // In traversal order
+    int cropX0, cropY0, cropX1, cropY1;     // Pixels actually traced (the whole film without crop window)
+    std::unique_ptr<AccumulationBuffer> accum;
+
+    // Off-line checkpointing
+    std::unique_ptr<std::atomic<bool>[]> tileDone;
+    std::mutex checkpointMutex;
+    std::chrono::steady_clock::time_point lastCheckpoint;
+    bool checkpointOwned = false;           // The checkpoint file was written or resumed from by this render
+
+    // Off-line tile streaming: called with the current estimate of a tile each time it is updated
+    std::function<void(const Tile&)> onTileDone;
+
+    // Off-line cancellation of this render only (the process-wide token stops every render)
+    CancelToken cancelToken;
+
+    // Off-line camera setup
+    PinholeCamera camera;
+
+    explicit Renderer(const Config& config, std::shared_ptr<SceneData> sceneData = nullptr);
     bool init(bool isRealTime, bool nogui);
     void render();
     void cleanUp();
+
+    void setupOffline();
+    static std::vector<Tile> buildTiles(int x0, int y0, int x1, int y1, int tileSize, ETileOrder order);
+    void renderFullTile(const Tile& tile);
+    void renderTile(const Tile& tile, Sampler& sampler, int spp);
+    void renderPixel(int x, int y, Sampler& sampler, int spp);
+    void finishTile(const Tile& tile);
+    void resolve();
+    bool isCancelled() const;
+    uint32_t renderProgressive(uint32_t firstPass);
+    void renderPreview(int stride);
+    void upsampleTile(const Tile& tile, int stride);
+    uint32_t renderAdaptive(uint32_t firstRound);
+
+    bool isCheckpointing() const;
+    fs::path getCheckpointPath() const;
+    uint32_t getRenderMode() const;
+    void maybeCheckpoint(uint32_t progress);
+    void saveCheckpoint(uint32_t progress);
+    uint32_t loadCheckpoint();
 };
 
 TR_NAMESPACE_END
\ No newline at end of file
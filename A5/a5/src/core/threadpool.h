@@ -0,0 +1,312 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include <core/platform.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Persistent work-stealing thread pool.
+ * Workers are spawned once and shared by every parallel loop of the renderer.
+ * Each worker owns a deque: it pops its own tasks LIFO and steals other workers' tasks FIFO.
+ * A thread waiting on a loop keeps executing tasks, so parallel loops can be nested.
+ */
+class ThreadPool {
+public:
+
+    /**
+     * Counts the tasks of one parallel loop that have not finished yet, and keeps the first exception
+     * thrown by one of them (the loop skips its remaining indices once set).
+     */
+    struct TaskGroup {
+        std::atomic<int> pending{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        void fail(std::exception_ptr e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = e;
+            failed = true;
+        }
+    };
+
+    struct Task {
+        std::function<void()> func;
+        TaskGroup* group;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * Sets the total number of threads (workers + calling thread). 0 means one per core.
+     * Must not be called while a parallel loop is running.
+     */
+    static void setThreadCount(unsigned nbThreads) {
+        instance().resize(nbThreads);
+    }
+
+    static unsigned getThreadCount() {
+        return instance().nbThreads;
+    }
+
+    /**
+     * Pins each worker to its own CPU (Linux only, ignored elsewhere). CPUs are handed out
+     * one NUMA node after the other, so neighbouring workers share a node's caches and memory.
+     * The calling thread is left free. Must not be called while a parallel loop is running.
+     */
+    static void setPinning(bool pin) {
+        ThreadPool& pool = instance();
+        pool.pinned = pin;
+        pool.resize(pool.nbThreads);
+    }
+
+    /**
+     * Calls func(i) for i in [start, end).
+     * The range is recursively halved into tasks of at most grain indices (0 picks a grain
+     * giving ~8 tasks per thread); idle threads steal the largest pending halves.
+     * If func throws, the loop waits for the tasks already started and rethrows the first exception.
+     */
+    template<typename Index, typename Callable>
+    static void ParallelFor(Index start, Index end, Callable func, Index grain = 0) {
+        if (end <= start) return;
+        ThreadPool& pool = instance();
+        const Index n = end - start;
+        if (grain <= 0) grain = std::max(Index(1), Index(n / (8 * Index(pool.nbThreads))));
+
+        if (pool.nbThreads <= 1 || n <= grain) {
+            SequentialFor(start, end, func);
+            return;
+        }
+
+        TaskGroup group;
+        std::function<void(Index, Index)> run = [&](Index a, Index b) {
+            while (b - a > grain) {
+                const Index mid = a + (b - a) / 2;
+                pool.submit(group, [&run, mid, b]() { run(mid, b); });
+                b = mid;
+            }
+            for (Index i = a; i < b && !group.failed; i++) {
+                func(i);
+            }
+        };
+        // Submitted tasks refer to run and group: they must be done before unwinding this frame
+        try {
+            run(start, end);
+        } catch (...) {
+            group.fail(std::current_exception());
+        }
+        pool.wait(group);
+        if (group.error) std::rethrow_exception(group.error);
+    }
+
+    // Serial version for easy comparison
+    template<typename Index, typename Callable>
+    static void SequentialFor(Index start, Index end, Callable func) {
+        for (Index i = start; i < end; i++) {
+            func(i);
+        }
+    }
+
+    ~ThreadPool() {
+        resize(1);
+    }
+
+private:
+    unsigned nbThreads = 1;
+    bool pinned = false;
+    std::vector<int> cpus;                          // CPUs to pin workers to, grouped by NUMA node
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // One per worker, plus one for external threads
+    std::atomic<int> queued{0};
+    std::atomic<bool> stop{false};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    ThreadPool() {
+        resize(0);
+    }
+
+    static ThreadPool& instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // Index of the current thread in queues (-1 for threads outside the pool)
+    static int& workerIndex() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    void resize(unsigned n) {
+        if (n == 0) {
+            const unsigned hint = std::thread::hardware_concurrency();
+            n = hint == 0u ? 8u : hint;
+        }
+
+        // Join current workers
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) {
+            if (t.joinable()) t.join();
+        }
+        workers.clear();
+        stop = false;
+
+        // The calling thread takes part in every loop, so spawn n - 1 workers
+        nbThreads = n;
+        queues.clear();
+        for (unsigned i = 0; i < n; i++) {
+            queues.emplace_back(new WorkQueue());
+        }
+        if (pinned && cpus.empty()) cpus = getCpus();
+        for (unsigned i = 0; i + 1 < n; i++) {
+            workers.emplace_back([this, i]() { workerLoop(int(i)); });
+        }
+    }
+
+    // CPUs this process may run on, listed node by node
+    static std::vector<int> getCpus() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return cpus;
+        auto add = [&](int cpu) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)
+                && std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                cpus.push_back(cpu);
+            }
+        };
+        // Node CPU lists read like "0-3,8-11"
+        for (int node = 0; ; node++) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!in) break;
+            std::string range;
+            while (std::getline(in, range, ',')) {
+                std::istringstream r(range);
+                int first = 0, last;
+                char dash;
+                r >> first;
+                if (!(r >> dash >> last)) last = first;
+                for (int cpu = first; cpu <= last; cpu++) add(cpu);
+            }
+        }
+        // CPUs outside any node (or no NUMA information at all)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) add(cpu);
+#endif
+        return cpus;
+    }
+
+    // The calling thread would take the first CPU, worker i takes the next ones
+    void pin(int index) {
+#if defined(__linux__)
+        if (cpus.empty()) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[size_t(index + 1) % cpus.size()], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+    void submit(TaskGroup& group, std::function<void()> func) {
+        group.pending++;
+        int idx = workerIndex();
+        WorkQueue& q = *queues[idx < 0 ? queues.size() - 1 : size_t(idx)];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(Task{std::move(func), &group});
+        }
+        queued++;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Pops a task from the own queue (newest first) or steals one from another queue (oldest first)
+    bool runOne(int self) {
+        Task task;
+        bool found = false;
+        const size_t n = queues.size();
+        const size_t first = self < 0 ? n - 1 : size_t(self);
+        for (size_t k = 0; k < n && !found; k++) {
+            WorkQueue& q = *queues[(first + k) % n];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            if (k == 0) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            found = true;
+        }
+        if (!found) return false;
+
+        queued--;
+        try {
+            task.func();
+        } catch (...) {
+            task.group->fail(std::current_exception());
+        }
+        // The group may be destroyed as soon as its last task is done: not touched past this point
+        if (--task.group->pending == 0) {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            wake.notify_all();
+        }
+        return true;
+    }
+
+    // Helps running tasks until all tasks of the group are done, sleeping while there is nothing
+    // to run (the last tasks of the group being run by other threads)
+    void wait(TaskGroup& group) {
+        const int self = workerIndex();
+        while (group.pending > 0) {
+            if (runOne(self)) continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&]() { return group.pending == 0 || queued > 0; });
+        }
+    }
+
+    void workerLoop(int index) {
+        workerIndex() = index;
+        if (pinned) pin(index);
+        while (!stop) {
+            if (runOne(index)) continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stop || queued > 0; });
+        }
+    }
+};
+
+TR_NAMESPACE_END
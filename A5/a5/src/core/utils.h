@@ -12,6 +12,7 @@
 #include <tinyformat.h>
 #include "tinyexr.h"
 #include <iterator>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 
@@ -90,9 +91,9 @@ inline bool saveEXR(const GLfloat* pixels, const std::string& filename, const in
 }
 
 /**
- * Saves render buffer to .exr image file.
+ * Encodes a render buffer as an .exr image file in memory (half-float RGB).
  */
-inline bool saveEXR(const std::unique_ptr<v3f[]>& rgb, const std::string& filename, const int width, const int height) {
+inline bool encodeEXR(const v3f* rgb, const int width, const int height, std::vector<unsigned char>& out) {
     EXRHeader header;
     InitEXRHeader(&header);
 
@@ -140,21 +141,59 @@ inline bool saveEXR(const std::unique_ptr<v3f[]>& rgb, const std::string& filena
         header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_HALF;
     }
 
+    unsigned char* memory = nullptr;
     const char* err = nullptr;
-    int ret = SaveEXRImageToFile(&image, &header, filename.c_str(), &err);
-    if (ret != TINYEXR_SUCCESS) {
+    const size_t size = SaveEXRImageToMemory(&image, &header, &memory, &err);
+
+    free(header.channels);
+    free(header.pixel_types);
+    free(header.requested_pixel_types);
+
+    if (size == 0) {
         fprintf(stderr, "Save EXR err: %s\n", err);
         FreeEXRErrorMessage(err);
         return false;
     }
-    std::cout << "\nSaved EXR image to " << filename << std::endl;
+    out.assign(memory, memory + size);
+    free(memory);
+    return true;
+}
 
-    free(header.channels);
-    free(header.pixel_types);
-    free(header.requested_pixel_types);
+/**
+ * Saves render buffer to .exr image file.
+ */
+inline bool saveEXR(const std::unique_ptr<v3f[]>& rgb, const std::string& filename, const int width, const int height) {
+    std::vector<unsigned char> data;
+    if (!encodeEXR(rgb.get(), width, height, data)) return false;
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.write((const char*) data.data(), data.size())) {
+        fprintf(stderr, "Save EXR err: cannot write %s\n", filename.c_str());
+        return false;
+    }
+    std::cout << "\nSaved EXR image to " << filename << std::endl;
     return true;
 }
 
+/**
+ * Encodes a render buffer as a binary .ppm image (8-bit sRGB, clamped) in memory.
+ */
+inline void encodePPM(const v3f* rgb, const int width, const int height, std::vector<unsigned char>& out) {
+    const std::string header = tfm::format("P6\n%d %d\n255\n", width, height);
+    out.assign(header.begin(), header.end());
+    out.reserve(header.size() + 3 * size_t(width) * height);
+    auto encode = [](float v) {
+        v = std::min(std::max(v, 0.f), 1.f);
+        v = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+        return (unsigned char) (v * 255.f + 0.5f);
+    };
+    for (int i = 0; i < width * height; i++) {
+        out.push_back(encode(rgb[i].x));
+        out.push_back(encode(rgb[i].y));
+        out.push_back(encode(rgb[i].z));
+    }
+}
+
 /**
  * Variadic template constructor to support printf-style arguments.
  */
@@ -0,0 +1,252 @@
+/*
+    This file is part of TinyRender, an educative rendering system.
+
+    Designed for ECSE 446/546 Realistic/Advanced Image Synthesis.
+    Derek Nowrouzezahrai, McGill University.
+*/
+
+#pragma once
+
+#include "core.h"
+#include "bvh.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TR_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TR_TARGET_AVX2
+#else
+#define TR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+TR_NAMESPACE_BEGIN
+
+/**
+ * Returns whether the CPU and the OS support AVX2 (SSE is assumed on every x86 build).
+ */
+inline bool hasAVX2() {
+#if defined(TR_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(TR_X86)
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Ray set up for slab tests: reciprocal direction and, per axis, the bounds row of the near plane.
+ */
+struct SlabRay {
+    v3f o, inv;
+    int nearRow[3], farRow[3];
+
+    explicit SlabRay(const Ray& ray) : o(ray.o) {
+        for (int a = 0; a < 3; a++) {
+            // Axis-parallel rays get a huge but finite reciprocal, so that 0 * inv stays a number
+            const float d = std::abs(ray.d[a]) > 1e-20f ? ray.d[a] : std::copysign(1e-20f, ray.d[a]);
+            inv[a] = 1.f / d;
+            nearRow[a] = inv[a] >= 0.f ? a : a + 3;
+            farRow[a] = inv[a] >= 0.f ? a + 3 : a;
+        }
+    }
+};
+
+/**
+ * Collapsed BVH with up to N (4 or 8) children per node, built from a binary BVH.
+ * Child boxes are stored as structure of arrays, so that a single SIMD slab test covers every child of a
+ * node; hit children are visited nearest first. Leaves are ranges of the primitive list of the binary BVH.
+ */
+template<int N>
+struct WideBVH {
+    struct Node {
+        float bounds[6][N];     // Rows min x, y, z then max x, y, z (empty slots: +inf / -inf)
+        int32_t child[N];       // Inner children: node index, leaves: first primitive
+        uint32_t count[N];      // Primitives of leaf children, 0 for inner children and empty slots
+    };
+
+    // Entries of the traversal stack: a child to visit and its entry distance
+    struct Entry {
+        int32_t child;
+        uint32_t count;
+        float t;
+    };
+    static const int StackSize = 1024;
+
+    std::vector<Node> nodes;
+
+    /**
+     * Collapses a binary flattened tree: the children of a node are obtained by opening its largest inner
+     * descendants until N are found. Returns false if the tree is too deep for the traversal stack.
+     */
+    bool collapse(const BVHFlatNode* tree) {
+        nodes.clear();
+        struct Todo {
+            uint32_t binary, wide, depth;
+        };
+        std::vector<Todo> todo;
+        uint32_t maxDepth = 0;
+
+        // A root leaf is the single child of the root
+        nodes.push_back(Node());
+        todo.push_back(Todo{0, 0, 1});
+        bool rootIsLeaf = tree[0].rightOffset == 0;
+
+        while (!todo.empty()) {
+            const Todo t = todo.back();
+            todo.pop_back();
+            maxDepth = std::max(maxDepth, t.depth);
+
+            std::vector<uint32_t> children;
+            if (rootIsLeaf) {
+                children.push_back(0);
+                rootIsLeaf = false;
+            } else {
+                children.push_back(t.binary + 1);
+                children.push_back(t.binary + tree[t.binary].rightOffset);
+            }
+            while (children.size() < size_t(N)) {
+                int largest = -1;
+                for (size_t i = 0; i < children.size(); i++) {
+                    const BVHFlatNode& c = tree[children[i]];
+                    if (c.rightOffset != 0 && (largest < 0 || c.bbox.surfaceArea() > tree[children[largest]].bbox.surfaceArea()))
+                        largest = int(i);
+                }
+                if (largest < 0) break;
+                const uint32_t opened = children[largest];
+                children[largest] = opened + 1;
+                children.push_back(opened + tree[opened].rightOffset);
+            }
+
+            Node node;
+            for (int i = 0; i < N; i++) {
+                for (int a = 0; a < 3; a++) {
+                    node.bounds[a][i] = std::numeric_limits<float>::infinity();
+                    node.bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+                }
+                node.child[i] = 0;
+                node.count[i] = 0;
+            }
+            for (size_t i = 0; i < children.size(); i++) {
+                const BVHFlatNode& c = tree[children[i]];
+                for (int a = 0; a < 3; a++) {
+                    node.bounds[a][i] = c.bbox.min[a];
+                    node.bounds[a + 3][i] = c.bbox.max[a];
+                }
+                if (c.rightOffset == 0) {
+                    node.child[i] = int32_t(c.start);
+                    node.count[i] = c.nPrims;
+                } else {
+                    node.child[i] = int32_t(nodes.size());
+                    todo.push_back(Todo{children[i], uint32_t(nodes.size()), t.depth + 1});
+                    nodes.push_back(Node());
+                }
+            }
+            nodes[t.wide] = node;
+        }
+        return maxDepth * (N - 1) + 1 <= uint32_t(StackSize);
+    }
+
+    /**
+     * Slab test of the children of a node against [0, tMax]. Returns the mask of the children hit and
+     * their entry distances. Portable version, specialized with SSE and AVX2 on x86.
+     */
+    static int intersectChildren(const Node& node, const SlabRay& r, float tMax, float* dist) {
+        int mask = 0;
+        for (int i = 0; i < N; i++) {
+            float tNear = 0.f, tFar = tMax;
+            for (int a = 0; a < 3; a++) {
+                tNear = std::max(tNear, (node.bounds[r.nearRow[a]][i] - r.o[a]) * r.inv[a]);
+                tFar = std::min(tFar, (node.bounds[r.farRow[a]][i] - r.o[a]) * r.inv[a]);
+            }
+            dist[i] = tNear;
+            if (tNear <= tFar) mask |= 1 << i;
+        }
+        return mask;
+    }
+
+    /**
+     * Traverses the tree, calling leaf(start, count, tMax) on every leaf the ray may hit before tMax.
+     * The leaf function returns whether it found a hit, after lowering tMax to it.
+     * With anyHit, stops at the first hit. Returns whether any leaf reported a hit.
+     */
+    template<typename Leaf>
+    bool traverse(const Ray& ray, float tMax, Leaf leaf, bool anyHit = false) const {
+        const SlabRay r(ray);
+        Entry stack[StackSize];
+        int stackptr = 0;
+        stack[stackptr++] = Entry{0, 0, 0.f};
+        bool hit = false;
+
+        while (stackptr > 0) {
+            const Entry e = stack[--stackptr];
+            if (e.t > tMax) continue;
+
+            if (e.count > 0) {
+                if (leaf(uint32_t(e.child), e.count, tMax)) {
+                    hit = true;
+                    if (anyHit) return true;
+                }
+                continue;
+            }
+
+            // Push the children hit farthest first, so that the nearest is visited next
+            const Node& node = nodes[e.child];
+            float dist[N];
+            int mask = intersectChildren(node, r, tMax, dist);
+            const int first = stackptr;
+            for (int i = 0; mask; i++, mask >>= 1) {
+                if (!(mask & 1)) continue;
+                int j = stackptr++;
+                for (; j > first && stack[j - 1].t < dist[i]; j--) stack[j] = stack[j - 1];
+                stack[j] = Entry{node.child[i], node.count[i], dist[i]};
+            }
+        }
+        return hit;
+    }
+};
+
+#if defined(TR_X86)
+/**
+ * SSE slab test of the 4 children of a node.
+ */
+template<>
+inline int WideBVH<4>::intersectChildren(const Node& node, const SlabRay& r, float tMax, float* dist) {
+    __m128 tNear = _mm_setzero_ps(), tFar = _mm_set1_ps(tMax);
+    for (int a = 0; a < 3; a++) {
+        const __m128 o = _mm_set1_ps(r.o[a]), inv = _mm_set1_ps(r.inv[a]);
+        tNear = _mm_max_ps(tNear, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[r.nearRow[a]]), o), inv));
+        tFar = _mm_min_ps(tFar, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[r.farRow[a]]), o), inv));
+    }
+    _mm_storeu_ps(dist, tNear);
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+/**
+ * AVX2 slab test of the 8 children of a node (only called once hasAVX2() was checked).
+ */
+TR_TARGET_AVX2 inline int intersectChildrenAVX2(const WideBVH<8>::Node& node, const SlabRay& r, float tMax, float* dist) {
+    __m256 tNear = _mm256_setzero_ps(), tFar = _mm256_set1_ps(tMax);
+    for (int a = 0; a < 3; a++) {
+        const __m256 o = _mm256_set1_ps(r.o[a]), inv = _mm256_set1_ps(r.inv[a]);
+        tNear = _mm256_max_ps(tNear, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[r.nearRow[a]]), o), inv));
+        tFar = _mm256_min_ps(tFar, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[r.farRow[a]]), o), inv));
+    }
+    _mm256_storeu_ps(dist, tNear);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+
+template<>
+inline int WideBVH<8>::intersectChildren(const Node& node, const SlabRay& r, float tMax, float* dist) {
+    return intersectChildrenAVX2(node, r, tMax, dist);
+}
+#endif
+
+TR_NAMESPACE_END
@@ -143,7 +143,6 @@ TR_NAMESPACE_BEGIN
             size_t id = selectEmitter(sampler.next(), emPDF);
             const Emitter& em = getEmitterByID(id);
             v3f normal,pos;
-            SurfaceInteraction infoShadow;
 
             //sets pos, normal, pdf
             sampleEmitterPosition(sampler, em, normal, pos, areaPDF);
@@ -156,17 +155,15 @@ TR_NAMESPACE_BEGIN
             float cosTheta0 = fmax(0.f,glm::dot(-wiW,normal)/glm::length(-wiW)/glm::length(normal));
             float jacobDet = cosTheta0/glm::pow(glm::length(info.p-pos),2.f);
 
+            //if nothing blocks the light sample, return the corresponding illumination info
             Ray shadowRay = Ray(info.p, wiW, Epsilon);
-            if (scene.bvh->intersect(shadowRay, infoShadow)) {
-                //if hit the light, return the corresponding illumination info
-                if (getEmission(infoShadow) != v3f(0.f)) {
-                    if ((emPDF*areaPDF) <= 0.f) {
-                        return v3f(0.f);
-                    }
+            if (!scene.bvh->occluded(shadowRay, glm::length(pos - info.p) * (1.f - ShadowEpsilon))) {
+                if ((emPDF*areaPDF) <= 0.f) {
+                    return v3f(0.f);
+                }
 
-                    if (cosThetai >= 0.f) {
-                        Lr = getEmission(infoShadow) * getBSDF(info)->eval(info)*jacobDet*cosThetai/emPDF/areaPDF;
-                    }
+                if (cosThetai >= 0.f) {
+                    Lr = em.getRadiance() * getBSDF(info)->eval(info)*jacobDet*cosThetai/emPDF/areaPDF;
                 }
             }
             return Lr;
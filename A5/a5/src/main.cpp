@@ -8,142 +8,226 @@
 #include <core/core.h>
 #include <core/platform.h>
 #include <core/renderer.h>
+#include <core/jobs.h>
+#include <core/daemon.h>
+#include <core/coordinator.h>
+#include <core/benchmark.h>
+#include <core/imagewriter.h>
+#include <core/interactive.h>
+#include <core/memory.h>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
-
-
-/**
- * Load TOML scene file and create scene objects.
- */
-bool loadTOML(TinyRender::Config& config, const std::string& inputFile) {
-    // Scene and Wavefront OBJ files
-    const auto data = cpptoml::parse_file(inputFile);
-    config.tomlFile = inputFile;
-    const auto input = data->get_table("input");
-    config.objFile = *input->get_as<std::string>("objfile");
-
-    // Camera settings
-    const auto camera = data->get_table("camera");
-    config.camera.fov = camera->get_as<double>("fov").value_or(30.);
-    auto eye = camera->get_array_of<double>("eye").value_or({1., 1., 0.});
-    config.camera.o = v3f(eye[0], eye[1], eye[2]);
-    auto at = camera->get_array_of<double>("at").value_or({0., 0., 0.});
-    config.camera.at = v3f(at[0], at[1], at[2]);
-    auto up = camera->get_array_of<double>("up").value_or({0., 1., 0.});
-    config.camera.up = v3f(up[0], up[1], up[2]);
-
-    // Film settings
-    const auto film = data->get_table("film");
-    config.width = film->get_as<int>("width").value_or(768);
-    config.height = film->get_as<int>("height").value_or(576);
-
-    // Renderer settings
-    const auto renderer = data->get_table("renderer");
-    auto realTime = renderer->get_as<bool>("realtime").value_or(false);
-    auto type = renderer->get_as<std::string>("type").value_or("normal");
-
-    // Real-time renderpass
-    if (realTime) {
-        if (type == "normal") {
-            config.renderpass = TinyRender::ENormalRenderPass;
-        }
-        else if (type == "direct") {
-            config.renderpass = TinyRender::EDirectRenderPass;
-        }
-        else if (type == "ssao") {
-            config.renderpass = TinyRender::ESSAORenderPass;
-        }
-        else if (type == "gi") {
-            config.renderpass = TinyRender::EGIRenderPass;
-            config.integratorSettings.gi.maxDepth = renderer->get_as<int>("maxDepth").value_or(5);
-            config.integratorSettings.gi.rrDepth = renderer->get_as<int>("rrDepth").value_or(5);
-            config.integratorSettings.gi.rrProb = renderer->get_as<double>("rrProb").value_or(9.95f);
-            config.integratorSettings.gi.samplesByVertex = renderer->get_as<int>("samplesByVertex").value_or(100);
-        }
-        else {
-            throw std::runtime_error("Invalid renderpass type");
-        }
-    }
-
-    // Offline integrator
-    else {
-        if (type == "normal") {
-            config.integrator = TinyRender::ENormalIntegrator;
-        }
-        else if (type == "simple") {
-            config.integrator = TinyRender::ESimpleIntegrator;
-        }
-        else if (type == "ao") {
-            config.integrator = TinyRender::EAOIntegrator;
-        }
-        else if (type == "ro") {
-            config.integrator = TinyRender::EROIntegrator;
-            config.integratorSettings.ro.exponent = renderer->get_as<double>("exponent").value_or(30);
-        }
-        else if (type == "direct") {
-            config.integrator = TinyRender::EDirectIntegrator;
-            config.integratorSettings.di.emitterSamples = renderer->get_as<size_t>("emitterSamples").value_or(1);
-            config.integratorSettings.di.bsdfSamples = renderer->get_as<size_t>("bsdfSamples").value_or(1);
-            config.integratorSettings.di.samplingStrategy = renderer->get_as<string>("samplingStrategy").value_or("emitter");
-        }
-        else if (type == "path") {
-            config.integrator = TinyRender::EPathTracerIntegrator;
-            config.integratorSettings.pt.isExplicit = renderer->get_as<bool>("isExplicit").value_or(true);
-            config.integratorSettings.pt.maxDepth = renderer->get_as<int>("maxDepth").value_or(-1);
-            config.integratorSettings.pt.rrDepth = renderer->get_as<int>("rrDepth").value_or(5);
-            config.integratorSettings.pt.rrProb = renderer->get_as<double>("rrProb").value_or(0.95f);
-        }
-        else {
-            throw std::runtime_error("Invalid integrator type");
-        }
-
-        config.spp = renderer->get_as<int>("spp").value_or(1);
-    }
-
-    return realTime;
-}
+using TinyRender::loadTOML;
 
 /**
  * Launch rendering job.
  */
-void run(std::string& inputTOMLFile, bool nogui) {
+void run(std::string& inputTOMLFile, bool nogui, bool resume, const std::vector<int>& crop, bool splice, int nbJobs) {
     TinyRender::Config config;
     bool isRealTime;
 
     try {
         isRealTime = loadTOML(config, inputTOMLFile);
+        if (crop.size() == 4) TinyRender::setCropWindow(config, crop[0], crop[1], crop[2], crop[3]);
+        if (splice) config.crop.splice = true;
     } catch (std::exception const& e) {
         std::cerr << "Error while parsing scene file: " << e.what() << std::endl;
         exit(EXIT_FAILURE);
     }
+    config.checkpoint.resume = resume;
+
+    // Real-time scenes without a window get the CPU preview, streamed to stdout
+    if (isRealTime && nogui) {
+        if (!TinyRender::runInteractive(inputTOMLFile, 2, "ppm", "")) exit(EXIT_FAILURE);
+        return;
+    }
+
+    // Animations and multi-view scenes render all their frames or views in one process
+    if (!isRealTime && (config.animation.frames > 0 || !config.views.list.empty())) {
+        if (!TinyRender::runBatch({inputTOMLFile}, nbJobs, resume, crop, splice)) exit(EXIT_FAILURE);
+        return;
+    }
 
     TinyRender::Renderer renderer(config);
     renderer.init(isRealTime, nogui);
     renderer.render();
+    if (!isRealTime) {
+        std::cout << "Memory: scene " << TinyRender::formatBytes(TinyRender::getMemoryUsage(*renderer.scene.data))
+                  << ", framebuffers " << TinyRender::formatBytes(TinyRender::getMemoryUsage(renderer))
+                  << ", process peak RSS " << TinyRender::formatBytes(TinyRender::getPeakRSS()) << std::endl;
+    }
     renderer.cleanUp();
+    if (!TinyRender::ImageWriter::flush()) exit(EXIT_FAILURE);
+    if (!isRealTime && renderer.isCancelled()) exit(EXIT_FAILURE);
 }
 
 /**
- * Main TinyRender program.
+ * Parses the numeric value of a command line flag, exiting with an error if it is not a whole number
+ * (or a number, for parseFloat) in the range of an int.
  */
-int main(int argc, char* argv[]) {
-    if (argc != 2 && argc !=3) {
-        cerr << "Syntax: " << argv[0] << " <scene.toml>" << endl;
+static int parseInt(const std::string& flag, const char* value) {
+    char* end = nullptr;
+    errno = 0;
+    const long n = std::strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX) {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << std::endl;
         exit(EXIT_FAILURE);
     }
+    return int(n);
+}
 
+static float parseFloat(const std::string& flag, const char* value) {
+    char* end = nullptr;
+    errno = 0;
+    const float x = std::strtof(value, &end);
+    if (end == value || *end != '\0' || errno == ERANGE || !std::isfinite(x)) {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return x;
+}
+
+/**
+ * Main TinyRender program.
+ */
+int main(int argc, char* argv[]) {
+    std::vector<std::string> inputs;
     bool nogui = false;
-    if(argc == 3) {
-        if(std::string(argv[2]) == "nogui") {
+    bool resume = false;
+    int nbJobs = 0;
+    std::string daemonSocket, submitSocket, outputFile, workerSocket, socketPath;
+    int nbWorkers = 0;
+    float stallTimeout = 0.f;
+    std::vector<int> crop;
+    bool splice = false;
+    bool benchmark = false;
+    bool interactive = false;
+    int previewScale = 2;
+    std::string previewFormat = "ppm";
+    for (int i = 1; i < argc; i++) {
+        const std::string arg(argv[i]);
+        if (arg == "nogui") {
             nogui = true;
         }
+        else if (arg == "--resume") {
+            resume = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            TinyRender::ThreadPool::setThreadCount(unsigned(std::max(1, parseInt(arg, argv[++i]))));
+        }
+        else if (arg == "--daemon" && i + 1 < argc) {
+            daemonSocket = argv[++i];
+        }
+        else if (arg == "--submit" && i + 1 < argc) {
+            submitSocket = argv[++i];
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            outputFile = argv[++i];
+        }
+        else if (arg == "--coordinator" && i + 1 < argc) {
+            nbWorkers = std::max(0, parseInt(arg, argv[++i]));
+        }
+        else if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        }
+        else if (arg == "--stall-timeout" && i + 1 < argc) {
+            stallTimeout = std::max(0.f, parseFloat(arg, argv[++i]));
+        }
+        else if (arg == "--worker" && i + 1 < argc) {
+            workerSocket = argv[++i];
+        }
+        else if (arg == "--crop" && i + 4 < argc) {
+            for (int k = 0; k < 4; k++) crop.push_back(parseInt(arg, argv[++i]));
+        }
+        else if (arg == "--splice") {
+            splice = true;
+        }
+        else if (arg == "--pin") {
+            TinyRender::ThreadPool::setPinning(true);
+        }
+        else if (arg == "--benchmark") {
+            benchmark = true;
+        }
+        else if (arg == "--interactive") {
+            interactive = true;
+        }
+        else if (arg == "--scale" && i + 1 < argc) {
+            previewScale = std::max(1, parseInt(arg, argv[++i]));
+        }
+        else if (arg == "--format" && i + 1 < argc) {
+            previewFormat = argv[++i];
+        }
+        else if (arg == "--memory-budget" && i + 1 < argc) {
+            TinyRender::MemoryBudget::setLimit(size_t(std::max(0, parseInt(arg, argv[++i]))) << 20);
+        }
+        else if (arg == "--jobs" && i + 1 < argc) {
+            nbJobs = std::max(1, parseInt(arg, argv[++i]));
+        }
+        else {
+            inputs.push_back(arg);
+        }
+    }
+
+    // Worker mode: tiles are requested by a coordinator
+    if (!workerSocket.empty()) {
+        return TinyRender::runWorker(workerSocket) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Daemon mode: the scenes given are only preloaded, SIGINT/SIGTERM shut the daemon down
+    if (!daemonSocket.empty()) {
+        TinyRender::cancelOnSignals();
+        return TinyRender::runDaemon(daemonSocket, inputs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (inputs.empty() || ((!submitSocket.empty() || nbWorkers > 0 || interactive) && inputs.size() != 1)) {
+        cerr << "Syntax: " << argv[0] << " <scene.toml> [nogui] [--threads N] [--pin] [--resume] [--crop x0 y0 x1 y1] [--splice]" << endl;
+        cerr << "        " << argv[0] << " <scene.toml|dir>... [--jobs N] [--memory-budget MB] [--threads N] [--resume]" << endl;
+        cerr << "        " << argv[0] << " --daemon <socket> [scene.toml...] [--memory-budget MB] [--threads N]" << endl;
+        cerr << "        " << argv[0] << " --submit <socket> <scene.toml> [--output image.exr]" << endl;
+        cerr << "        " << argv[0] << " --coordinator <workers> <scene.toml> [--socket path] [--stall-timeout s]" << endl;
+        cerr << "        " << argv[0] << " --benchmark <scene.toml>... [--threads N] [--pin]" << endl;
+        cerr << "        " << argv[0] << " --interactive <scene.toml> [--scale N] [--format ppm|exr] [--socket path] [--threads N]" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Client mode: render on a resident daemon
+    if (!submitSocket.empty()) {
+        return TinyRender::submitJob(submitSocket, inputs[0], outputFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Multi-process mode: tiles are distributed to local worker processes
+    if (nbWorkers > 0) {
+        return TinyRender::runCoordinator(inputs[0], argv[0], nbWorkers, socketPath, stallTimeout)
+               ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Benchmark mode: tile orders and sizes are compared, nothing is saved
+    if (benchmark) {
+        return TinyRender::runTileBenchmark(inputs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Off-line renders stop on SIGINT/SIGTERM, saving what they have so far
+    TinyRender::cancelOnSignals();
+
+    // Headless interactive mode: frames are streamed to a viewer, which can move the camera
+    if (interactive) {
+        return TinyRender::runInteractive(inputs[0], previewScale, previewFormat, socketPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Batch mode: several scenes rendered offline by the same process
+    if (inputs.size() > 1 || fs::is_directory(inputs[0])) {
+        return TinyRender::runBatch(inputs, nbJobs, resume, crop, splice) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    auto inputTOMLFile = std::string(argv[1]);
-    run(inputTOMLFile, nogui);
+    auto inputTOMLFile = inputs[0];
+    run(inputTOMLFile, nogui, resume, crop, splice, nbJobs);
 
 #ifdef _WIN32
     if(!nogui) system("pause");
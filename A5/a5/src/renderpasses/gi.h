@@ -49,9 +49,9 @@ struct GIPass : RenderPass {
         obj.nVerts = scene.getObjectNbVertices(objectIdx);
         obj.vertices.resize(obj.nVerts * N_ATTR_PER_VERT);
 
-        int k = 0;
-
-        for (size_t i = 0; i < obj.nVerts; i++) {
+        // Bake vertices in parallel; samples are keyed on the vertex and sample index so the result is deterministic
+        ThreadPool::ParallelFor(size_t(0), size_t(obj.nVerts), [&](size_t i) {
+            const size_t k = i * N_ATTR_PER_VERT;
             v3f normal = scene.getObjectVertexNormal(objectIdx, i);
             v3f pos = scene.getObjectVertexPosition(objectIdx, i);
             v3f RGB = v3f(0.f);
@@ -76,6 +76,7 @@ struct GIPass : RenderPass {
 
             //accumulate RGB data in vertex then take the average
             for (int j = 0; j < m_samplePerVertex; j++) {
+                sampler.startPixelSample(uint32_t(i), uint32_t(j));
                 RGB += m_ptIntegrator->renderExplicit(ray, sampler, info,0);
             }
             RGB /= m_samplePerVertex;
@@ -83,10 +84,7 @@ struct GIPass : RenderPass {
             obj.vertices[k + 3] = RGB.x;
             obj.vertices[k + 4] = RGB.y;
             obj.vertices[k + 5] = RGB.z;
-
-            k += N_ATTR_PER_VERT;
-
-        }
+        });
         // VBO
         glGenVertexArrays(1, &obj.vao);
         glBindVertexArray(obj.vao);